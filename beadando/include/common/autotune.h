@@ -0,0 +1,73 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "opencl/run_cl.h"
+
+#include <stddef.h>
+
+/* ======================================================================
+ * Self-calibrating backend / thread-count selection
+ *
+ * A short calibration times every candidate configuration (OpenMP with
+ * 1, 2, 4, ... threads, and OpenCL when a device is present) on a few
+ * payload sizes.  The timings form a piecewise-linear cost model over
+ * payload size; autotune_pick() returns the cheapest configuration for
+ * a given call.  Each (k, sequential / keyed order) class is measured
+ * separately: k changes how many carriers a byte spans, and the keyed
+ * order turns streaming access into gather/scatter.  Results are cached
+ * per host, so calibration runs once.
+ * ====================================================================== */
+
+#define AUTOTUNE_SIZES       4
+#define AUTOTUNE_MAX_CONFIGS 16
+#define AUTOTUNE_BITS        4                      /* k = 1 .. 4    */
+#define AUTOTUNE_CLASSES     (2 * AUTOTUNE_BITS)    /* x seq / keyed */
+
+typedef enum { AUTOTUNE_ENCODE = 0, AUTOTUNE_DECODE = 1 } AutotuneOp;
+
+typedef struct {
+    int    use_ocl;                 /* 1 = OpenCL, 0 = OpenMP          */
+    int    threads;                 /* OMP team size (0 for OpenCL)    */
+    double time[AUTOTUNE_SIZES];    /* seconds per call at sizes[i]    */
+} AutotuneConfig;
+
+typedef struct {
+    size_t         sizes[AUTOTUNE_SIZES];   /* payload bytes, ascending */
+    AutotuneConfig configs[AUTOTUNE_CLASSES][2][AUTOTUNE_MAX_CONFIGS];
+    int            n_configs[AUTOTUNE_CLASSES][2];
+} AutotuneModel;
+
+/*
+ * Load the cached model for this host, or calibrate and write the cache
+ * when it is missing, stale (different host / CPU count / ISA) or when
+ * refresh != 0.  Returns 0 on success, -1 on error.
+ */
+int autotune_init(AutotuneModel* model, int refresh);
+
+/*
+ * Measure every configuration.  cl may be NULL (OpenMP only).
+ * Returns 0 on success, -1 on error.
+ */
+int autotune_calibrate(AutotuneModel* model, CLContext* cl);
+
+/* Predicted seconds for one call with a payload of `bytes`. */
+double autotune_predict(const AutotuneModel* model, const AutotuneConfig* cfg,
+                        size_t bytes);
+
+/*
+ * Cheapest configuration for op at `bytes` with k = bits, in keyed
+ * order if keyed != 0; NULL if that class is empty or bits is out of range.
+ */
+const AutotuneConfig* autotune_pick(const AutotuneModel* model, AutotuneOp op,
+                                    int bits, int keyed, size_t bytes);
+
+/* Whether any OpenCL configuration was calibrated. */
+int autotune_has_ocl(const AutotuneModel* model);
+
+/*
+ * Cache location: $STEGO_AUTOTUNE_CACHE, else the per-user cache dir
+ * ($XDG_CACHE_HOME, ~/.cache, %LOCALAPPDATA%) + "/stego/autotune.cache".
+ */
+void autotune_cache_path(char* buf, size_t size);
+
+#endif /* AUTOTUNE_H */
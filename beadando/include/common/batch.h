@@ -0,0 +1,94 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "common/autotune.h"
+
+#include <stddef.h>
+
+/* ======================================================================
+ * Batch encode / decode
+ *
+ * One process handles many files: engines (thread teams, OpenCL
+ * contexts, decode scratch) are set up once per worker instead of once
+ * per image.  Large images are processed one at a time with the whole
+ * team inside each image; the rest are spread over a work-stealing pool
+ * where every worker runs single-threaded on its own files.
+ *
+ * With a pipeline budget (pipe_load > 0) the jobs instead flow through
+ * three overlapped stages -- load, encode/decode, save -- joined by
+ * bounded queues of BATCH_QUEUE_DEPTH images, each stage with its own
+ * threads: image i+1 is read and image i-1 written while image i is
+ * being transformed.  Per-stage utilization shows the bottleneck.
+ * ====================================================================== */
+
+/* Images waiting between two pipeline stages */
+#define BATCH_QUEUE_DEPTH 2
+
+typedef enum {
+    BATCH_STAGE_LOAD = 0, BATCH_STAGE_WORK = 1, BATCH_STAGE_SAVE = 2
+} BatchStage;
+
+typedef enum { BATCH_ENCODE = 0, BATCH_DECODE = 1 } BatchOp;
+
+typedef struct {
+    char*  input;       /* carrier (encode) or stego image (decode)   */
+    char*  output;      /* stego image (encode) or message (decode)   */
+    char*  message;     /* encode only; NULL = BatchConfig.message    */
+    size_t input_size;  /* file size in bytes, for scheduling          */
+} BatchJob;
+
+typedef struct {
+    BatchJob* jobs;
+    int       count;
+    int       cap;
+} BatchList;
+
+typedef struct {
+    BatchOp              op;
+    int                  workers;   /* pool size (0 = OMP default)     */
+    int                  use_ocl;
+    int                  bits;      /* encode only                     */
+    const char*          key;       /* keyed scatter passphrase, NULL  */
+    const char*          message;   /* encode: shared message file     */
+    const AutotuneModel* model;     /* --auto for large images, NULL   */
+    int                  pipe_load; /* pipeline: load threads (0 = off) */
+    int                  pipe_work; /* pipeline: engine team size       */
+    int                  pipe_save; /* pipeline: save threads           */
+} BatchConfig;
+
+typedef struct {
+    int    done;
+    int    failed;
+    size_t bytes;       /* raster bytes processed                      */
+    double seconds;
+    /* pipeline only: threads and busy fraction of the wall time per stage */
+    int    stage_threads[3];
+    double stage_util[3];
+} BatchStats;
+
+/*
+ * Jobs for every .ppm / .png / .qoi file in in_dir (any case).  Encode writes
+ * out_dir/<name>, decode writes out_dir/<name>.txt.
+ * Returns 0 on success, -1 on error.
+ */
+int batch_scan_dir(BatchList* list, BatchOp op, const char* in_dir,
+                   const char* out_dir);
+
+/*
+ * Jobs from a manifest, one per line (blank lines and '#' comments are
+ * skipped):   encode:  <carrier> <output> [<message>]
+ *             decode:  <stego>   <output>
+ * Returns 0 on success, -1 on error.
+ */
+int batch_load_manifest(BatchList* list, BatchOp op, const char* path);
+
+void batch_list_free(BatchList* list);
+
+/*
+ * Run every job.  Failures are reported on stderr and counted; the
+ * remaining jobs still run.  Returns 0 if every job succeeded.
+ */
+int batch_run(const BatchList* list, const BatchConfig* cfg,
+              BatchStats* stats);
+
+#endif /* BATCH_H */
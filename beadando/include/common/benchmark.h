@@ -1,6 +1,9 @@
 #ifndef BENCHMARK_H
 #define BENCHMARK_H
 
+#include "openmp/stego_kernels.h"
+#include "common/pixel_buffer.h"
+
 /* ======================================================================
  * BenchmarkConfig  --  everything run_benchmark() needs
  * ====================================================================== */
@@ -12,6 +15,10 @@ typedef struct {
     int  trials;         /* timed repetitions per (n, p) combination */
     char csv_path[256];
     int  plot_enabled;
+    StegoIsa isa;        /* OMP kernel variant (default: detected) */
+    int  bits;           /* k-LSB bits per channel byte (default: 1) */
+    NumaPolicy numa;     /* placement of carrier buffers */
+    int  huge_pages;     /* 1 = huge-page backed carriers */
 } BenchmarkConfig;
 
 /*
@@ -22,7 +29,9 @@ int run_benchmark(const BenchmarkConfig* cfg);
 
 /*
  * Parse argc/argv into cfg.
- * Accepts: [n=<val> [val...]] [p=<val> [val...]] [-noplot]
+ * Accepts: [n=<val> [val...]] [p=<val> [val...]] [t=<val>] [-noplot]
+ *          [--isa scalar|sse2|avx2|avx512|auto] [--bits 1..4]
+ *          [--numa none|first-touch|interleave] [--hugepages on|off]
  * Falls back to built-in defaults if n or p are not supplied.
  * Returns 0 on success, non-zero on bad arguments.
  */
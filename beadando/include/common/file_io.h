@@ -0,0 +1,43 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ======================================================================
+ * Positioned bulk file I/O
+ *
+ * Image rasters and message files are moved with these instead of
+ * stdio.  The default backend is a pread/pwrite loop.  Built with
+ * STEGO_IO_URING (make IO_URING=1, Linux 5.6+) a transfer is split
+ * into FILE_IO_CHUNK pieces and up to FILE_IO_DEPTH of them are kept in
+ * flight on a per-thread io_uring, so one large read reaches the queue
+ * depth an NVMe device needs, and several threads (batch --pipeline
+ * load/save stages) add their rings on top.  If the kernel refuses the
+ * ring or the opcodes, the process falls back to pread/pwrite.  A ring
+ * is closed when its thread exits, or after an error once the requests
+ * it still had in flight have completed.
+ * ====================================================================== */
+
+#define FILE_IO_CHUNK ((size_t)1 << 20)
+#define FILE_IO_DEPTH 16
+
+/*
+ * Read exactly len bytes at offset from fd into buf.
+ * Returns 0 on success, -1 on error or end of file.
+ */
+int file_read_at(int fd, void* buf, size_t len, uint64_t offset);
+
+/*
+ * Write exactly len bytes from buf at offset to fd.
+ * Returns 0 on success, -1 on error.
+ */
+int file_write_at(int fd, const void* buf, size_t len, uint64_t offset);
+
+/* 1 if large transfers go (or will try to go) through io_uring */
+int file_io_async(void);
+
+/* "io_uring" once a ring is in use, else "pread" */
+const char* file_io_backend(void);
+
+#endif /* FILE_IO_H */
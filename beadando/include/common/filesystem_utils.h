@@ -10,4 +10,16 @@
  */
 int create_output_directories(const char* file_path);
 
+/**
+ * List the regular files directly inside `dir` (no recursion), sorted by
+ * name.  `*names` receives a malloc'd array of `*count` malloc'd names
+ * (file names only, without the directory); release it with
+ * free_directory_listing().
+ * Returns 0 on success, -1 on error.
+ */
+int list_directory_files(const char* dir, char*** names, int* count);
+
+/** Free a listing returned by list_directory_files(). */
+void free_directory_listing(char** names, int count);
+
 #endif
\ No newline at end of file
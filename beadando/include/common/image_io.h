@@ -3,6 +3,13 @@
 
 #include "common/stego_types.h"
 
+#include <stdio.h>
+
+/*
+ * Load a PNG as 3-channel RGB.  8-bit RGB/RGBA non-interlaced files take
+ * the png_read() fast path, everything else goes through stb_image.
+ * Returns 0 on success, -1 on error.
+ */
 int image_load_png(const char* path, Image* img);
 
 /* Save img as a PNG file. Returns 0 on success, -1 on error. */
@@ -10,30 +17,78 @@ int image_save_png(const char* path, const Image* img);
 
 /*
  * Load a binary PPM (P6) file into img.
- * img->pixels is malloc'd; call image_free() when done.
+ * img->pixels comes from pixel_alloc(); call image_free() when done.
+ * Under a NUMA policy the raster is read by parallel pread() calls.
  * Returns 0 on success, -1 on error.
  */
 int image_load_ppm(const char* path, Image* img);
 
+/*
+ * Open path and parse a binary PPM (P6) header; on success the file is
+ * positioned at the first raster byte.  Returns the open file, or NULL
+ * after reporting.
+ */
+FILE* image_open_ppm(const char* path, int* width, int* height);
+
+/* Access wanted from a mapped image (see image_map_ppm) */
+typedef enum {
+    IMAGE_MAP_READ,     /* read-only: writing to pixels faults          */
+    IMAGE_MAP_PRIVATE   /* copy-on-write: writes never reach the file   */
+} ImageMapMode;
+
+/*
+ * Map a binary PPM (P6) instead of reading it: img->pixels points at the
+ * raster inside the file mapping and only pages that are touched are
+ * read (e.g. decode reads just the first 32 + 8*len/k carrier bytes).
+ * Use IMAGE_MAP_READ for decode, IMAGE_MAP_PRIVATE for in-place encode.
+ * Falls back to image_load_ppm() where mmap is unavailable.
+ * Release with image_free().  Returns 0 on success, -1 on error.
+ */
+int image_map_ppm(const char* path, Image* img, ImageMapMode mode);
+
+/* image_map_ppm() for .ppm paths, image_load() for everything else. */
+int image_map(const char* path, Image* img, ImageMapMode mode);
+
 /*
  * Save img to a binary PPM (P6) file.
  * Returns 0 on success, -1 on error.
  */
 int image_save_ppm(const char* path, const Image* img);
 
-/* Load an image from any supported format (PPM, PNG).
+/*
+ * Save img to path as a copy of `source` (the PPM img was loaded from)
+ * with only raster bytes [begin, end) rewritten from img->pixels.  The
+ * copy is a reflink or an in-kernel copy where the filesystem allows,
+ * so a small payload in a huge carrier costs O(payload) writes.
+ * Falls back to image_save_threads(..., num_threads) unless both paths
+ * are .ppm and source has img's dimensions.
+ * Returns 0 on success, -1 on error.
+ */
+int image_save_ppm_patch(const char* path, const char* source,
+                         const Image* img, size_t begin, size_t end,
+                         int num_threads);
+
+/* Load an image from any supported format (PPM, PNG, QOI).
    Returns 0 on success, -1 on error. */
 int image_load(const char* path, Image* img);
 
 /* Save img to a file, choosing format from extension.
- * Supported extensions: .ppm (binary P6), .png (lossless RGB).
+ * Supported extensions: .ppm (binary P6), .png (lossless RGB),
+ * .qoi (lossless RGB, strips encoded in parallel).
  * Directories in the path are created automatically.
  * Returns 0 on success, -1 on error.
  */
 int image_save(const char* path, const Image* img);
 
 /*
- * Allocate a new Image (pixels are uninitialized).
+ * image_save() with an explicit team size for the parallel PNG and QOI
+ * encoders (0 = OMP default), for callers with a fixed thread budget.
+ */
+int image_save_threads(const char* path, const Image* img, int num_threads);
+
+/*
+ * Allocate a new Image (pixel contents are unspecified).
+ * Pages are placed according to the NUMA policy (see pixel_buffer.h).
  * Returns 0 on success, -1 on allocation failure.
  */
 int image_alloc(Image* img, int width, int height, int channels);
@@ -44,7 +99,7 @@ int image_alloc(Image* img, int width, int height, int channels);
 void image_free(Image* img);
 
 /*
- * Deep-copy src into dst (fresh malloc for pixels).
+ * Deep-copy src into dst (fresh pixel buffer, copied in parallel).
  * Returns 0 on success, -1 on failure.
  */
 int image_copy(Image* dst, const Image* src);
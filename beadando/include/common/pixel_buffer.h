@@ -0,0 +1,119 @@
+#ifndef PIXEL_BUFFER_H
+#define PIXEL_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ======================================================================
+ * NumaPolicy  --  where the pages of large pixel buffers are placed
+ * ====================================================================== */
+typedef enum {
+    NUMA_POLICY_NONE = 0,     /* plain malloc, filled by the calling thread  */
+    NUMA_POLICY_FIRST_TOUCH,  /* filled in parallel with a static schedule,
+                                 so each page lands on its worker's node    */
+    NUMA_POLICY_INTERLEAVE    /* pages round-robin across all nodes (mbind) */
+} NumaPolicy;
+
+/* Process-wide policy for every later pixel_alloc(); default FIRST_TOUCH. */
+void       pixel_set_numa_policy(NumaPolicy policy);
+NumaPolicy pixel_numa_policy(void);
+
+/*
+ * Parse "none", "first-touch" or "interleave".
+ * Returns 0 on success, -1 on an unknown name.
+ */
+int pixel_parse_numa_policy(const char* name, NumaPolicy* policy);
+
+/*
+ * Huge-page backing for buffers of 2 MiB and more (default on).
+ * Uses MAP_HUGETLB when pages are reserved, else a 2 MiB-aligned mapping
+ * with a transparent-huge-page hint; falls back to the heap silently.
+ */
+void pixel_set_huge_pages(int enabled);
+int  pixel_huge_pages(void);
+
+/*
+ * Allocate a 64-byte aligned pixel buffer of `size` bytes (contents
+ * undefined, pages not yet touched).  Huge pages and interleave are
+ * applied here.  Returns NULL on failure.
+ */
+uint8_t* pixel_alloc(size_t size);
+
+/*
+ * Map `size` bytes of the open file fd, starting at `offset`, as a pixel
+ * buffer without reading it: pages are faulted in from the page cache
+ * only when touched.
+ * writable: 0 = read-only (any write faults),
+ *           1 = MAP_PRIVATE copy-on-write (the file is never modified).
+ * fd may be closed afterwards.  Unlike pixel_alloc() the buffer is not
+ * 64-byte aligned.  Returns NULL on failure (always on Windows).
+ */
+uint8_t* pixel_map_file(int fd, uint64_t offset, size_t size, int writable);
+
+/*
+ * Release a buffer from pixel_alloc() or pixel_map_file(); NULL is
+ * ignored.  Pooled buffers go back to the pool.  Never free() it.
+ */
+void pixel_free(uint8_t* buf, size_t size);
+
+/* ======================================================================
+ * Buffer pool  --  size-classed reuse of large pixel buffers
+ *
+ * With a non-zero limit, pixel_alloc() requests of 256 KiB and more are
+ * rounded up to a size class (four per power of two) and served from
+ * idle buffers of that class; pixel_free() parks them again while the
+ * idle total stays under the limit.  Recycled buffers keep their pages
+ * (and NUMA placement), so steady-state loops such as bench trials or
+ * batch jobs do no large allocations and take no page faults.
+ * ====================================================================== */
+
+#define PIXEL_POOL_DEFAULT_LIMIT ((size_t)1 << 30)
+
+typedef struct {
+    size_t hits;        /* pixel_alloc() served from the pool */
+    size_t misses;      /* pooled-size requests that allocated */
+    size_t idle_bytes;  /* parked right now                    */
+} PixelPoolStats;
+
+/* Process-wide idle limit in bytes; 0 (default) disables the pool and
+ * releases everything parked. */
+void   pixel_pool_set_limit(size_t bytes);
+size_t pixel_pool_limit(void);
+
+/*
+ * Park `count` pre-faulted buffers of size's class, so even the first
+ * pixel_alloc() of that size is fault-free.  Returns 0, or -1 if out
+ * of memory or over the limit.
+ */
+int pixel_pool_reserve(size_t size, int count);
+
+/* Release every idle buffer (the limit is unchanged). */
+void pixel_pool_trim(void);
+void pixel_pool_stats(PixelPoolStats* st);
+
+/*
+ * Fault in every page of buf (zero-filled), each thread of the default
+ * team touching its pixel_place_range() slice, so each page lands on the
+ * node of the thread that will process it.
+ * No-op under NUMA_POLICY_NONE (pages fault in on first real write) and
+ * for buffers recycled from the pool, whose pages are already placed
+ * (their contents are left as they are).
+ */
+void pixel_first_touch(uint8_t* buf, size_t size);
+
+/* memcpy with the same placement rules (serial under NUMA_POLICY_NONE). */
+void pixel_copy(uint8_t* dst, const uint8_t* src, size_t size);
+
+/*
+ * Slice [*begin, *end) of buf placed by thread `part` of a `parts`-thread
+ * team.  This is the share the OpenMP kernels' static schedule gives that
+ * thread on a full-capacity frame (payload blocks map to contiguous
+ * carrier ranges in thread order), with inner boundaries moved to whole
+ * huge pages (2 MiB with huge pages on, else 4 KiB) of buf's address so
+ * no page is shared by two threads.  Loaders (parallel pread) fill a
+ * buffer with the same thread-to-page map.
+ */
+void pixel_place_range(const uint8_t* buf, size_t size, int part, int parts,
+                       size_t* begin, size_t* end);
+
+#endif /* PIXEL_BUFFER_H */
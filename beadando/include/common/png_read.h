@@ -0,0 +1,24 @@
+#ifndef PNG_READ_H
+#define PNG_READ_H
+
+#include "common/stego_types.h"
+
+/* ======================================================================
+ * Fast-path PNG reader
+ *
+ * Covers the common carrier case: 8-bit RGB or RGBA, non-interlaced.
+ * The IDAT stream is inflated with a table-driven decoder (64-bit bit
+ * buffer, one refill per symbol, word-wise match copies) and each row
+ * is unfiltered with SSE2 straight into the 3-channel Image raster; the
+ * previous row for Up/Average/Paeth is the row already in the raster.
+ * Everything else (palette, grey, 16-bit, interlaced) is left to stb.
+ * ====================================================================== */
+
+/*
+ * Load path into img (always 3 channels, pixels from pixel_alloc()).
+ * Returns 0 on success, -1 if the file is outside the fast path or
+ * cannot be decoded; img is untouched then and the caller falls back.
+ */
+int png_read(const char* path, Image* img);
+
+#endif /* PNG_READ_H */
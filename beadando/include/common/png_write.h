@@ -0,0 +1,33 @@
+#ifndef PNG_WRITE_H
+#define PNG_WRITE_H
+
+#include "common/stego_types.h"
+
+/* ======================================================================
+ * Parallel PNG writer
+ *
+ * Rows are filtered in parallel (adaptive filter per row), then the
+ * filtered stream is cut into fixed-size chunks that are deflated
+ * independently, pigz-style: each chunk is primed with the previous
+ * 32 KiB as its dictionary and ends with a sync flush (empty stored
+ * block), so the pieces join into one valid zlib stream.  The stream's
+ * Adler-32 is combined from per-chunk checksums and every chunk goes out
+ * as its own IDAT with its own CRC, so nothing is concatenated in memory.
+ * ====================================================================== */
+
+#define PNG_LEVEL_MIN     0   /* stored blocks, no filtering            */
+#define PNG_LEVEL_MAX     9   /* deepest match search                   */
+#define PNG_LEVEL_DEFAULT 6
+
+/* Process-wide compression level for image_save_png(); clamped to 0..9. */
+void png_set_level(int level);
+int  png_level(void);
+
+/*
+ * Write img (1..4 channels, 8 bits) as a PNG at `level` with a team of
+ * num_threads (0 = OMP default).  The caller creates directories.
+ * Returns 0 on success, -1 on error.
+ */
+int png_write(const char* path, const Image* img, int level, int num_threads);
+
+#endif /* PNG_WRITE_H */
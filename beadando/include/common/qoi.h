@@ -0,0 +1,32 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include "common/stego_types.h"
+
+/* ======================================================================
+ * QOI ("Quite OK Image") reader/writer
+ *
+ * Lossless, byte-oriented and an order of magnitude faster than PNG at
+ * comparable sizes.  Large images are encoded in parallel strips of
+ * QOI_STRIP_PIXELS: each strip starts from the real previous pixel and
+ * only emits INDEX ops for colour-cache slots it wrote itself, so the
+ * concatenated strips are an ordinary QOI stream any decoder reads.
+ * ====================================================================== */
+
+#define QOI_STRIP_PIXELS (256 * 1024)
+
+/*
+ * Load a QOI file as 3-channel RGB (alpha is dropped).
+ * img->pixels comes from pixel_alloc(); call image_free() when done.
+ * Returns 0 on success, -1 on error.
+ */
+int qoi_load(const char* path, Image* img);
+
+/*
+ * Save img (3 or 4 channels) as QOI with a team of num_threads
+ * (0 = OMP default).  The caller creates directories.
+ * Returns 0 on success, -1 on error.
+ */
+int qoi_save(const char* path, const Image* img, int num_threads);
+
+#endif /* QOI_H */
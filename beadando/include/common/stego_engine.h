@@ -0,0 +1,82 @@
+#ifndef STEGO_ENGINE_H
+#define STEGO_ENGINE_H
+
+#include "common/autotune.h"
+#include "common/stego_scatter.h"
+#include "common/stego_types.h"
+#include "opencl/run_cl.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ======================================================================
+ * StegoEngine  --  reusable, self-contained encode/decode handle
+ *
+ * Owns its thread budget, a decode scratch buffer and (optionally) an
+ * OpenCL context.  Nothing process-global is modified, so independent
+ * engines may run concurrently from different threads.  A single engine
+ * must not be used by two threads at once.
+ * ====================================================================== */
+typedef struct {
+    int       num_threads;  /* OMP team size for every call (>= 1)      */
+    int       use_ocl;      /* 1 = run on the OpenCL device             */
+    CLContext cl;           /* valid only when use_ocl                  */
+    uint8_t*  scratch;      /* decode output, reused across calls       */
+    size_t    scratch_cap;
+
+    /* Auto mode: backend and team size picked per call from a model */
+    const AutotuneModel* model;     /* NULL = fixed configuration      */
+    int       last_ocl;     /* configuration used by the last call      */
+    int       last_threads;
+
+    StegoKey  key;          /* keyed scatter order, valid when keyed    */
+    int       keyed;
+
+    /* Carrier bytes [dirty_begin, dirty_end) changed by the last encode */
+    size_t    dirty_begin;
+    size_t    dirty_end;
+} StegoEngine;
+
+/*
+ * Set up an engine.
+ * num_threads: OMP team size (0 = OMP_NUM_THREADS / system default,
+ *              resolved once here).
+ * use_ocl:     1 = initialise an OpenCL context owned by the engine.
+ * Returns 0 on success, -1 on error (e.g. cl_init failed).
+ */
+int stego_engine_init(StegoEngine* eng, int num_threads, int use_ocl);
+
+/*
+ * Set up an engine that picks backend and thread count per call from a
+ * calibrated model (see autotune.h).  The model must outlive the engine.
+ * An OpenCL context is created only if the model contains OpenCL timings.
+ * Returns 0 on success, -1 on error.
+ */
+int stego_engine_init_auto(StegoEngine* eng, const AutotuneModel* model);
+
+/*
+ * Embed / extract in the keyed scatter order derived from passphrase
+ * (see stego_scatter.h).  NULL or "" restores the sequential layout.
+ * Returns 0 on success, -1 on error.
+ */
+int stego_engine_set_key(StegoEngine* eng, const char* passphrase);
+
+/* Release the OpenCL context and scratch buffer. */
+void stego_engine_destroy(StegoEngine* eng);
+
+/*
+ * Embed msg into img at `bits` LSBs per channel byte.
+ * Returns 0 on success, -1 on error.
+ */
+int stego_engine_encode(StegoEngine* eng, Image* img, const StegoMessage* msg,
+                        int bits);
+
+/*
+ * Extract the hidden message.  On success *data points into the engine's
+ * scratch buffer and stays valid until the next call on this engine.
+ * Returns 0 on success, -1 on error.
+ */
+int stego_engine_decode(StegoEngine* eng, const Image* img,
+                        const uint8_t** data, size_t* length);
+
+#endif /* STEGO_ENGINE_H */
@@ -0,0 +1,83 @@
+#ifndef STEGO_SCATTER_H
+#define STEGO_SCATTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ======================================================================
+ * Keyed scatter order for the message body
+ *
+ * Sequential mode writes body carrier j to byte 32 + j.  Keyed mode
+ * writes it to 32 + P(j), where P is a key-dependent permutation of
+ * [0, domain) with domain = carrier bytes after the header.  P is a
+ * 4-round balanced Feistel network on the smallest even bit width that
+ * covers the domain; results outside the domain are fed back through
+ * the network (cycle walking) until they land inside.  Every index is
+ * computed independently in O(1) expected time, so no table is built
+ * and the OMP loop / OpenCL kernel stay fully parallel.
+ *
+ * The header stays sequential in carrier[0..32).  kernels/steganography.cl
+ * carries an identical copy of stego_scatter_index().
+ * ====================================================================== */
+
+#define STEGO_SCATTER_ROUNDS 4
+
+/* Round keys derived from a passphrase */
+typedef struct {
+    uint32_t round[STEGO_SCATTER_ROUNDS];
+} StegoKey;
+
+/* Permutation of [0, domain) for one carrier */
+typedef struct {
+    uint64_t domain;
+    unsigned half;      /* bits per Feistel half                */
+    uint32_t mask;      /* (1 << half) - 1                      */
+    uint32_t round[STEGO_SCATTER_ROUNDS];
+} StegoScatter;
+
+/*
+ * Derive round keys from a non-empty passphrase.
+ * Returns 0 on success, -1 if passphrase is NULL or empty.
+ */
+int stego_key_derive(StegoKey* key, const char* passphrase);
+
+/* Bind key to a carrier with `domain` body carrier bytes (domain >= 1). */
+void stego_scatter_init(StegoScatter* s, const StegoKey* key, uint64_t domain);
+
+/* Feistel round function: 32-bit avalanche mix of half ^ round key */
+static inline uint32_t stego_scatter_round(uint32_t x, uint32_t k)
+{
+    x ^= k;
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/* Carrier slot (relative to the header end) of body carrier j < domain */
+static inline uint64_t stego_scatter_index(const StegoScatter* s, uint64_t j)
+{
+    uint64_t x = j;
+    do {
+        uint32_t l = (uint32_t)(x >> s->half);
+        uint32_t r = (uint32_t)x & s->mask;
+        for (int i = 0; i < STEGO_SCATTER_ROUNDS; i++) {
+            uint32_t t = l ^ (stego_scatter_round(r, s->round[i]) & s->mask);
+            l = r;
+            r = t;
+        }
+        x = ((uint64_t)l << s->half) | r;
+    } while (x >= s->domain);
+    return x;
+}
+
+/* Write-intent / read prefetch of one scattered carrier byte */
+#if defined(__GNUC__)
+#  define STEGO_PREFETCH_W(p) __builtin_prefetch((p), 1, 0)
+#  define STEGO_PREFETCH_R(p) __builtin_prefetch((p), 0, 0)
+#else
+#  define STEGO_PREFETCH_W(p) ((void)(p))
+#  define STEGO_PREFETCH_R(p) ((void)(p))
+#endif
+
+#endif /* STEGO_SCATTER_H */
@@ -0,0 +1,40 @@
+#ifndef STEGO_STREAM_H
+#define STEGO_STREAM_H
+
+#include "common/stego_types.h"
+
+#include <stddef.h>
+
+/* ======================================================================
+ * Streaming PPM encode / decode
+ *
+ * The raster is never held whole: it moves through a ring of
+ * STREAM_RING strips of whole rows (about strip_bytes each, rounded so
+ * every strip starts on an 8-carrier group).  Encode chains a read, an
+ * embed and a write task per strip by OMP task dependences on the ring
+ * slot, so strip i+1 is read while strip i is embedded and strip i-1
+ * written; strips past the frame skip the embed step and are copied
+ * straight through.  Decode reads strips only until the frame ends.
+ * Peak memory is STREAM_RING * strip_bytes whatever the image size.
+ * Sequential (unkeyed) frames only.
+ * ====================================================================== */
+
+#define STREAM_STRIP_DEFAULT ((size_t)4 << 20)
+#define STREAM_RING          3
+
+/*
+ * Embed msg at `bits` bits per channel byte while copying the PPM `in`
+ * to `out` (which must be a different file).  strip_bytes 0 = default.
+ * Returns 0 on success, -1 on error.
+ */
+int stego_stream_encode(const char* in, const char* out,
+                        const StegoMessage* msg, int bits, size_t strip_bytes);
+
+/*
+ * Extract the message from the PPM `in`, reading no further than the
+ * frame.  msg->data is malloc'd; call stego_message_free() when done.
+ * Returns 0 on success, -1 on error.
+ */
+int stego_stream_decode(const char* in, StegoMessage* msg, size_t strip_bytes);
+
+#endif /* STEGO_STREAM_H */
@@ -25,10 +25,14 @@ typedef struct {
     size_t   length;   /* byte count; does NOT include the framing prefix */
 } StegoMessage;
 
-/* Maximum bytes that can be hidden: one bit per channel byte */
-static inline size_t stego_capacity_bytes(const Image* img)
+/* Supported bits-per-channel range for k-LSB embedding */
+#define STEGO_MIN_BITS 1
+#define STEGO_MAX_BITS 4
+
+/* Maximum bytes that can be hidden: `bits` bits per channel byte */
+static inline size_t stego_capacity_bytes(const Image* img, int bits)
 {
-    return (size_t)(img->width * img->height * img->channels) / 8;
+    return (size_t)img->width * img->height * img->channels * bits / 8;
 }
 
 static inline void stego_message_free(StegoMessage* msg)
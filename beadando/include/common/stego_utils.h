@@ -5,20 +5,83 @@
 #include <stdint.h>
 #include <stddef.h>
 
-/*
- * Build the framed payload that gets embedded into the carrier.
- * Layout: [4-byte LE length][message bytes]
+/* ======================================================================
+ * Frame layout
  *
- * Returns a malloc'd buffer of length (4 + msg->length).
- * Caller must free() the result.
- * Returns NULL on allocation failure.
+ *   carrier[0 .. 32)   32-bit LE header, always 1 bit per channel byte:
+ *                      bits 0..29 = body length, bits 30..31 = k - 1
+ *   carrier[32 .. )    body, k bits per channel byte (k = 1..4)
+ * ====================================================================== */
+#define STEGO_HEADER_CARRIER 32
+#define STEGO_MAX_LENGTH     ((1u << 30) - 1)
+
+/* ======================================================================
+ * StegoSegment  --  one contiguous piece of payload, read in place
+ * ====================================================================== */
+typedef struct {
+    const uint8_t* data;
+    size_t         length;
+} StegoSegment;
+
+/* Maximum number of caller segments (body, trailer, ...) per payload */
+#define STEGO_MAX_SEGMENTS 8
+
+/* ======================================================================
+ * StegoPayload  --  the framed payload as a gather list
+ * ====================================================================== */
+typedef struct {
+    uint8_t      header[4];
+    StegoSegment segs[STEGO_MAX_SEGMENTS];  /* body pieces, in order */
+    int          n_segs;
+    size_t       length;                    /* body byte count       */
+    int          bits;                      /* k                     */
+} StegoPayload;
+
+/*
+ * Describe the payload body[0 .. n_body) embedded at `bits` bits per
+ * channel byte, without copying it.
+ * Returns 0 on success, -1 on too many segments, bad k or an oversize body.
  */
-uint8_t* stego_frame(const StegoMessage* msg, size_t* framed_len);
+int stego_payload_init(StegoPayload* p, const StegoSegment* body, int n_body,
+                       int bits);
 
 /*
- * Verify that msg fits inside img.
+ * Contiguous view of body bytes [begin, end).  Returns a pointer into the
+ * owning segment when the range lies inside one; otherwise gathers the
+ * pieces into scratch (at least end - begin bytes) and returns scratch.
+ */
+const uint8_t* stego_payload_view(const StegoPayload* p, size_t begin,
+                                  size_t end, uint8_t* scratch);
+
+/*
+ * Parse a 4-byte header into body length and k.
+ * Returns 0 on success, -1 if the header is zero-length.
+ */
+int stego_header_decode(const uint8_t header[4], size_t* length, int* bits);
+
+/* Carrier bytes used by a frame with a `length`-byte body at k = bits */
+static inline size_t stego_carrier_bytes(size_t length, int bits)
+{
+    return STEGO_HEADER_CARRIER + (length * 8 + (size_t)bits - 1) / (size_t)bits;
+}
+
+/*
+ * Verify that a body of `length` bytes at k = bits fits inside img.
  * Returns 0 if it fits, -1 if the message is too large.
  */
-int stego_check_capacity(const Image* img, const StegoMessage* msg);
+int stego_check_capacity(const Image* img, size_t length, int bits);
+
+/*
+ * Read a whole (non-empty) message file into msg.
+ * msg->data is malloc'd; call stego_message_free() when done.
+ * Returns 0 on success, -1 on error.
+ */
+int stego_message_load(const char* path, StegoMessage* msg);
+
+/*
+ * Write msg to path, creating missing directories.
+ * Returns 0 on success, -1 on error.
+ */
+int stego_message_save(const char* path, const StegoMessage* msg);
 
-#endif /* STEGO_UTILS_H */
\ No newline at end of file
+#endif /* STEGO_UTILS_H */
@@ -0,0 +1,36 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include "run_cl.h"
+
+/* ============================================================
+ * On-disk cache of built OpenCL program binaries
+ *
+ * A fresh process would otherwise JIT steganography.cl again
+ * for every -DBITS variant.  After a build, CL_PROGRAM_BINARIES
+ * is stored as <dir>/<key>.bin, where key is a 64-bit FNV-1a hash
+ * of the platform name/version, device name/version, driver
+ * version, the kernel source text and the build options.  Each
+ * file carries a magic, the full key and a checksum; a missing,
+ * truncated or corrupt entry, or one the driver rejects, simply
+ * falls back to a source build that rewrites it.
+ * ============================================================ */
+
+#define CL_CACHE_DIR_DEFAULT "data/cl_cache"
+
+/* Cache directory; NULL or "off" disables the cache. */
+void        cl_set_cache_dir(const char* dir);
+const char* cl_cache_dir(void);
+
+/*
+ * Program for (source, build_options) loaded from the cache and
+ * built for ctx->device_id, or NULL on a miss.
+ */
+cl_program cl_cache_load(CLContext* ctx, const char* source,
+                         const char* build_options);
+
+/* Store the binary of a built program; failures are ignored. */
+void cl_cache_store(CLContext* ctx, cl_program program, const char* source,
+                    const char* build_options);
+
+#endif /* PROGRAM_CACHE_H */
@@ -7,18 +7,100 @@
 /* ============================================================
  * CLContext  --  platform / device / context / queue
  * Completely task-agnostic; reuse as-is for any kernel.
+ *
+ * The context also caches built programs, keyed by source path
+ * and build options, and kernels, keyed by program and kernel
+ * name, so each combination is compiled once per process.  When
+ * a table is full the oldest entry is released (a kernel keeps
+ * its program alive).  Like the queue, the cache belongs to one
+ * thread at a time.  Source builds go through the on-disk
+ * binary cache of program_cache.h first.
+ *
+ * Device buffers are kept too: cl_run_kernel takes its cl_mem
+ * objects from a size-classed pool (four classes per power of
+ * two, up to CL_POOL_LIMIT idle bytes) instead of creating and
+ * releasing them per call, and a host range pinned with cl_pin
+ * stays resident, so kernels that read it skip the upload.
  * ============================================================ */
 
+#define CL_CACHE_SLOTS 32
+#define CL_POOL_SLOTS  16
+#define CL_POOL_LIMIT  ((size_t)256 << 20)
+#define CL_PIN_SLOTS   4
+
+typedef struct {
+    char*      source_path;
+    char*      build_options;   /* "" when built without options */
+    cl_program program;
+} CLProgramEntry;
+
+typedef struct {
+    cl_program program;         /* owner; compared by handle     */
+    char*      kernel_name;
+    cl_kernel  kernel;
+} CLKernelEntry;
+
+typedef struct {
+    cl_mem      mem;
+    size_t      size;           /* capacity (size class)          */
+} CLDeviceBuffer;
+
+typedef struct {
+    const void* host;           /* pinned host range, NULL = free */
+    size_t      size;
+    CLDeviceBuffer buf;
+} CLPinnedBuffer;
+
 typedef struct {
     cl_platform_id   platform_id;
     cl_device_id     device_id;
     cl_context       context;
     cl_command_queue command_queue;
+
+    CLProgramEntry   programs[CL_CACHE_SLOTS];
+    int              n_programs;    /* insertions so far (mod = next) */
+    CLKernelEntry    kernels[CL_CACHE_SLOTS];
+    int              n_kernels;
+
+    CLDeviceBuffer   pool[CL_POOL_SLOTS];   /* idle, oldest first */
+    int              n_pool;
+    CLPinnedBuffer   pinned[CL_PIN_SLOTS];
 } CLContext;
 
 int  cl_init(CLContext* ctx);
 void cl_cleanup(CLContext* ctx);
 
+/*
+ * Cached kernel `kernel_name` from source_path built with
+ * build_options (may be NULL).  Loads and builds on the first
+ * request only; the kernel stays owned by ctx (do not release).
+ * Returns NULL on failure (build log printed).
+ */
+cl_kernel cl_get_kernel(CLContext* ctx, const char* source_path,
+                        const char* kernel_name, const char* build_options);
+
+/*
+ * Upload host[0 .. size) once and keep it on the device: every
+ * CLBufferDesc with this host_ptr (and size <= size) then binds
+ * the resident buffer instead of uploading.  Kernels that write
+ * it and read_back keep both copies equal; after changing the
+ * host bytes any other way, call cl_pin again to refresh.
+ * Returns 0 on success, -1 on error (e.g. all slots in use).
+ */
+int  cl_pin(CLContext* ctx, const void* host, size_t size);
+int  cl_is_pinned(const CLContext* ctx, const void* host, size_t size);
+void cl_unpin(CLContext* ctx, const void* host);
+
+
+/* ============================================================
+ * CLHostSegment  --  one piece of a gathered upload
+ * ============================================================ */
+
+typedef struct {
+    const void* ptr;
+    size_t      size;
+} CLHostSegment;
+
 
 /* ============================================================
  * CLBufferDesc  --  describes one device buffer
@@ -33,11 +115,18 @@ typedef struct {
                                 May be NULL for buffers used only on the device. */
     size_t       size;       /* Size in bytes.                                   */
     cl_mem_flags flags;      /* E.g. CL_MEM_READ_ONLY, CL_MEM_WRITE_ONLY,
-                                CL_MEM_READ_WRITE.
-                                CL_MEM_COPY_HOST_PTR is added automatically
-                                when host_ptr != NULL and buffer is readable.   */
+                                CL_MEM_READ_WRITE: the kernel's access.
+                                host_ptr is uploaded when the buffer is
+                                readable.  Pooled cl_mem objects are always
+                                allocated CL_MEM_READ_WRITE so any desc can
+                                reuse them.                                    */
     int          read_back;  /* 1 = copy device buffer back to host_ptr after
                                 the kernel finishes.  0 = leave on device.      */
+    const CLHostSegment* segments;
+                             /* Optional gather list (host_ptr must be NULL):
+                                the pieces are written back-to-back into the
+                                buffer, so the host never concatenates them.   */
+    int          n_segments;
 } CLBufferDesc;
 
 
@@ -90,6 +179,8 @@ typedef struct {
     const size_t* global_size;  /* Array of `work_dim` elements.          */
     const size_t* local_size;   /* Array of `work_dim` elements, or NULL
                                    for implementation-chosen size.        */
+    const char*   build_options;/* Passed to clBuildProgram (e.g. "-D"
+                                   specialisations), or NULL.             */
 } CLKernelDesc;
 
 
@@ -106,13 +197,18 @@ typedef struct {
  * Returns 0 on success, non-zero on any failure.
  *
  * What this function handles automatically:
- *   1. Load + compile the kernel source (prints build log on error).
- *   2. For each CLBufferDesc: allocate cl_mem; if host_ptr != NULL and
- *      the buffer is readable, upload the host data.
+ *   1. Fetch the kernel from the context cache (cl_get_kernel),
+ *      compiling it on first use.
+ *   2. For each CLBufferDesc: bind the resident buffer if host_ptr
+ *      is pinned; otherwise take a cl_mem from the pool and, if
+ *      host_ptr != NULL and the buffer is readable, upload the host
+ *      data; if segments are given, write each one at its running
+ *      offset.
  *   3. Call bind_args (caller sets arguments).
  *   4. Enqueue NDRangeKernel.
  *   5. For each CLBufferDesc where read_back == 1: download to host_ptr.
- *   6. Release all cl_mem, kernel, and program objects.
+ *   6. Return the cl_mem objects to the pool (the kernel stays
+ *      cached, pinned buffers stay resident).
  * ============================================================ */
 
 int cl_run_kernel(CLContext*          ctx,
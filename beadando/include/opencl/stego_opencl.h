@@ -1,20 +1,54 @@
 #ifndef STEGO_OPENCL_H
 #define STEGO_OPENCL_H
 
+#include "common/stego_scatter.h"
 #include "common/stego_types.h"
+#include "common/stego_utils.h"
 #include "run_cl.h"
 
+#include <limits.h>
+
 /*
- * Embed msg into img on the GPU using LSB steganography.
- * img->pixels is modified in-place (written back from device after kernel).
+ * Longest message the OpenCL path takes.  The kernels index payload bits
+ * and carriers with int, so 8 * length + header must stay below INT_MAX
+ * (about 256 MiB, under STEGO_MAX_LENGTH); longer frames are rejected.
+ */
+#define STEGO_OCL_MAX_LENGTH \
+    ((size_t)(INT_MAX - STEGO_HEADER_CARRIER) / 8)
+
+/*
+ * Embed msg into img on the GPU using k-LSB steganography.
+ * img->pixels is modified in-place: only the carrier prefix the frame
+ * rewrites is uploaded and read back (the whole image when keyed).
  *
+ * bits: channel bits replaced per carrier byte (k = 1..STEGO_MAX_BITS);
+ *       the kernels are built with -DBITS=<k>.
  * ctx must already be initialised with cl_init().
  * Returns 0 on success, -1 on error.
  */
-int stego_encode_ocl(CLContext* ctx, Image* img, const StegoMessage* msg);
+int stego_encode_ocl(CLContext* ctx, Image* img, const StegoMessage* msg,
+                     int bits);
+
+/*
+ * Same as stego_encode_ocl, but the message is the concatenation of
+ * body[0 .. n_body).  Each segment is uploaded straight into its offset
+ * of the device payload buffer; the host never builds a framed copy.
+ */
+int stego_encode_ocl_segments(CLContext* ctx, Image* img,
+                              const StegoSegment* body, int n_body, int bits);
+
+/*
+ * Same as stego_encode_ocl_segments, but body carrier bytes are spread
+ * over the image in the keyed order of stego_scatter.h (NULL = sequential).
+ */
+int stego_encode_ocl_keyed(CLContext* ctx, Image* img,
+                           const StegoSegment* body, int n_body, int bits,
+                           const StegoKey* key);
 
 /*
- * Extract the hidden message from img on the GPU.
+ * Extract the hidden message from img on the GPU (k read from the header).
+ * A single launch decodes the body; only the carrier prefix the frame
+ * occupies is uploaded (the whole image when keyed).
  * msg->data is malloc'd; call stego_message_free() when done.
  *
  * ctx must already be initialised with cl_init().
@@ -22,4 +56,27 @@ int stego_encode_ocl(CLContext* ctx, Image* img, const StegoMessage* msg);
  */
 int stego_decode_ocl(CLContext* ctx, const Image* img, StegoMessage* msg);
 
+/*
+ * Same as stego_decode_ocl, but decodes into *buf, growing it with
+ * realloc() when the message exceeds *cap.  *length receives the size.
+ */
+int stego_decode_ocl_into(CLContext* ctx, const Image* img, uint8_t** buf,
+                          size_t* cap, size_t* length);
+
+/* Keyed-order counterpart of stego_decode_ocl_into (NULL = sequential). */
+int stego_decode_ocl_keyed_into(CLContext* ctx, const Image* img,
+                                const StegoKey* key, uint8_t** buf,
+                                size_t* cap, size_t* length);
+
+/*
+ * Keep img's pixels resident on the device (cl_pin): encodes and
+ * decodes of this image then skip the carrier upload, so an
+ * encode -> verify-decode chain or several messages against one
+ * carrier transfer it once.  Encode still reads the result back,
+ * keeping host and device equal.  Unpin before freeing the image.
+ * Returns 0 on success, -1 on error.
+ */
+int  stego_ocl_pin_image(CLContext* ctx, const Image* img);
+void stego_ocl_unpin_image(CLContext* ctx, const Image* img);
+
 #endif /* STEGO_OPENCL_H */
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef STEGO_KERNELS_H
+#define STEGO_KERNELS_H
+
+#include "common/stego_types.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ======================================================================
+ * StegoIsa  --  instruction-set tiers the LSB kernels are built for
+ * ====================================================================== */
+typedef enum {
+    STEGO_ISA_SCALAR = 0,   /* portable 64-bit SWAR, any CPU        */
+    STEGO_ISA_SSE2,         /* 16 carrier bytes per step            */
+    STEGO_ISA_AVX2,         /* 32 carrier bytes per step            */
+    STEGO_ISA_AVX512,       /* 64 carrier bytes per step (AVX512BW) */
+    STEGO_ISA_COUNT
+} StegoIsa;
+
+/*
+ * Byte-wise LSB kernels.
+ * encode: embed n payload bytes from src into the LSBs of dst[0 .. 8n).
+ * decode: extract n payload bytes from the LSBs of src[0 .. 8n) into dst.
+ */
+typedef void (*StegoEncodeFn)(uint8_t* dst, const uint8_t* src, size_t n);
+typedef void (*StegoDecodeFn)(uint8_t* dst, const uint8_t* src, size_t n);
+
+/* ======================================================================
+ * StegoKernels  --  one row of the dispatch table
+ * ====================================================================== */
+typedef struct {
+    StegoIsa      isa;
+    const char*   name;
+    StegoEncodeFn encode;
+    StegoDecodeFn decode;
+} StegoKernels;
+
+/*
+ * The active kernel table.  On first use it is filled with the widest
+ * variant the running CPU supports (cpuid), unless stego_kernels_select()
+ * was called before.
+ */
+const StegoKernels* stego_kernels(void);
+
+/*
+ * Force a specific variant (e.g. from a --isa flag).
+ * Returns 0 on success, -1 if this CPU / build cannot run it.
+ */
+int stego_kernels_select(StegoIsa isa);
+
+/* Widest variant supported by the running CPU. */
+StegoIsa stego_isa_detect(void);
+
+/*
+ * k-LSB kernels for bits = 1..STEGO_MAX_BITS (k = 1 is the active ISA entry).
+ * encode: embed n payload bytes into the low `bits` bits of
+ *         dst[0 .. ceil(8n / bits)).
+ * decode: the inverse, reading src[0 .. ceil(8n / bits)).
+ * Callers splitting work must start every call on a multiple of `bits`
+ * payload bytes, so that groups line up with whole carrier bytes.
+ */
+StegoEncodeFn stego_encode_kernel(int bits);
+StegoDecodeFn stego_decode_kernel(int bits);
+
+/*
+ * Parse "scalar", "sse2", "avx2", "avx512" (or "auto" = detect).
+ * Returns 0 on success, -1 on an unknown name.
+ */
+int stego_isa_parse(const char* name, StegoIsa* isa);
+
+#endif /* STEGO_KERNELS_H */
@@ -1,19 +1,43 @@
 #ifndef STEGO_OPENMP_H
 #define STEGO_OPENMP_H
 
+#include "common/stego_scatter.h"
 #include "common/stego_types.h"
+#include "common/stego_utils.h"
 
 /*
- * Embed msg into img using LSB steganography, parallelised with OpenMP.
+ * Embed msg into img using k-LSB steganography, parallelised with OpenMP.
  * img->pixels is modified in-place.
  *
- * num_threads: number of OMP threads (0 = use OMP_NUM_THREADS / default).
+ * bits: channel bits replaced per carrier byte (k = 1..STEGO_MAX_BITS);
+ *       recorded in the frame header so decode needs no hint.
+ * num_threads: team size for this call (0 = OMP_NUM_THREADS / default).
+ *              Passed as a num_threads clause, so concurrent callers
+ *              never disturb each other or the process-wide setting.
  * Returns 0 on success, -1 if msg is too large for the carrier.
  */
-int stego_encode_omp(Image* img, const StegoMessage* msg, int num_threads);
+int stego_encode_omp(Image* img, const StegoMessage* msg, int bits,
+                     int num_threads);
+
+/*
+ * Same as stego_encode_omp, but the message is the concatenation of
+ * body[0 .. n_body) (e.g. header fields, data, trailer).  Segments are
+ * read in place; no framed copy of the payload is made.
+ */
+int stego_encode_omp_segments(Image* img, const StegoSegment* body,
+                              int n_body, int bits, int num_threads);
+
+/*
+ * Same as stego_encode_omp_segments, but body carrier bytes are spread
+ * over the whole image in the keyed order of stego_scatter.h.
+ * key == NULL falls back to the sequential layout.
+ */
+int stego_encode_omp_keyed(Image* img, const StegoSegment* body, int n_body,
+                           int bits, const StegoKey* key, int num_threads);
 
 /*
  * Extract the hidden message from img using OpenMP.
+ * k is read from the frame header.
  * msg->data is malloc'd; call stego_message_free() when done.
  *
  * num_threads: same semantics as stego_encode_omp.
@@ -21,4 +45,20 @@ int stego_encode_omp(Image* img, const StegoMessage* msg, int num_threads);
  */
 int stego_decode_omp(const Image* img, StegoMessage* msg, int num_threads);
 
+/*
+ * Same as stego_decode_omp, but decodes into *buf, growing it with
+ * realloc() when the message exceeds *cap.  Lets callers keep one
+ * buffer across many calls.  *length receives the message size.
+ */
+int stego_decode_omp_into(const Image* img, uint8_t** buf, size_t* cap,
+                          size_t* length, int num_threads);
+
+/*
+ * Same as stego_decode_omp_into for a message written with
+ * stego_encode_omp_keyed; key must match the one used to encode.
+ */
+int stego_decode_omp_keyed_into(const Image* img, const StegoKey* key,
+                                uint8_t** buf, size_t* cap, size_t* length,
+                                int num_threads);
+
 #endif /* STEGO_OPENMP_H */
\ No newline at end of file
@@ -1,49 +1,186 @@
 /*
- * OpenCL kernels for LSB steganography.
+ * OpenCL kernels for k-LSB steganography.
+ *
+ * Build options:
+ *   -DBITS=<k>  channel bits per carrier byte (1..4, default 1).
+ *               Each k is compiled as its own specialised program.
+ *
+ * Frame layout: carrier[0..32) holds the 32-bit header at 1 bit per byte,
+ * the body follows at BITS bits per byte.
  *
  * Host code sets arguments as follows:
  *
  * encode_kernel:
  *   0 : __global uchar*   pixels   (read-write, carrier image bytes)
- *   1 : __global const uchar* payload (read-only, framed payload)
- *   2 : int                total_bits (number of LSBs to replace)
+ *   1 : __global const uchar* payload (read-only, 4-byte header + body)
+ *   2 : int                n_carriers (carrier bytes to rewrite, header included)
+ *   3 : int                body_len   (body bytes after the header)
  *
- * decode_kernel:
- *   0 : __global const uchar* pixels  (read-only, stego image bytes)
+ * decode_frame_kernel:
+ *   0 : __global const uchar* pixels  (read-only, stego image bytes, header included)
  *   1 : __global uchar*       output  (write-only, decoded message bytes)
- *   2 : int                   bit_offset (first bit to read; 0 for header, 32 for message)
- *   3 : int                   num_bytes  (how many output bytes to produce)
+ *   2 : int                   capacity (size of output; upper bound on the body)
+ *   Each work item reads the header itself and writes nothing past the
+ *   embedded length, nor anything at all if the header's k is not BITS.
+ *
+ * encode_scatter_kernel / decode_frame_scatter_kernel (keyed order):
+ *   same buffers as above, body carrier j goes to 32 + P(j) instead of
+ *   32 + j (see include/common/stego_scatter.h), and take
+ *   encode: 2 : int n_carriers, 3 : int body_len,
+ *   decode: 2 : int capacity,
+ *   then  : ulong domain (carrier bytes after the header),
+ *           uint  half   (bits per Feistel half),
+ *           uint4 keys   (round keys)
  */
 
+#ifndef BITS
+#define BITS 1
+#endif
+
+#define BITS_MASK ((1 << BITS) - 1)
+#define HEADER_CARRIER 32
+
 __kernel void encode_kernel(__global uchar* pixels,
                             __global const uchar* payload,
-                            int total_bits)
+                            int n_carriers,
+                            int body_len)
 {
     int i = get_global_id(0);
-    if (i >= total_bits) return;
+    if (i >= n_carriers) return;
+
+    // Header: always 1 bit per carrier byte
+    if (i < HEADER_CARRIER) {
+        uchar bit = (payload[i >> 3] >> (i & 7)) & 1;
+        pixels[i] = (pixels[i] & 0xFE) | bit;
+        return;
+    }
+
+    // Body: BITS consecutive payload bits per carrier byte
+    __global const uchar* body = payload + 4;
+    int pos   = (i - HEADER_CARRIER) * BITS;
+    int byte  = pos >> 3;
+    int shift = pos & 7;
+
+    uint v = body[byte];
+    // Only k = 3 can straddle a byte boundary; folds away otherwise
+    if (shift + BITS > 8 && byte + 1 < body_len)
+        v |= (uint)body[byte + 1] << 8;
 
-    // Extract the i-th payload bit: (payload[i/8] >> (i%8)) & 1
-    uchar bit = (payload[i >> 3] >> (i & 7)) & 1;
+    pixels[i] = (uchar)((pixels[i] & ~BITS_MASK) | ((v >> shift) & BITS_MASK));
+}
 
-    // Pixels[i] = (pixels[i] & 0xFE) | bit
-    pixels[i] = (pixels[i] & 0xFE) | bit;
+/* Body length the header claims, or 0 if it was not written at k = BITS */
+inline int frame_length(__global const uchar* pixels)
+{
+    uint word = 0;
+    for (int i = 0; i < HEADER_CARRIER; i++)
+        word |= (uint)(pixels[i] & 1) << i;
+    if ((int)(word >> 30) + 1 != BITS)
+        return 0;
+    return (int)(word & 0x3FFFFFFFu);
 }
 
-__kernel void decode_kernel(__global const uchar* pixels,
-                            __global uchar* output,
-                            int bit_offset,
-                            int num_bytes)
+__kernel void decode_frame_kernel(__global const uchar* pixels,
+                                  __global uchar* output,
+                                  int capacity)
 {
     int byte_i = get_global_id(0);
-    if (byte_i >= num_bytes) return;
+    if (byte_i >= capacity || byte_i >= frame_length(pixels)) return;
 
+    __global const uchar* body = pixels + HEADER_CARRIER;
     uchar val = 0;
-    int base = bit_offset + byte_i * 8;   // first pixel index for this byte
 
-    // Assemble 8 consecutive LSBs into one byte
+    // Assemble 8 consecutive payload bits, BITS per carrier byte
     for (int b = 0; b < 8; b++) {
-        val |= (pixels[base + b] & 1) << b;
+        int pos = byte_i * 8 + b;
+        val |= ((body[pos / BITS] >> (pos % BITS)) & 1) << b;
     }
 
     output[byte_i] = val;
-}
\ No newline at end of file
+}
+
+/* ---- keyed scatter order (mirror of stego_scatter_index) ---- */
+
+inline uint scatter_round(uint x, uint k)
+{
+    x ^= k;
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline ulong scatter_index(ulong j, ulong domain, uint half, uint4 keys)
+{
+    uint  mask = half >= 32 ? 0xffffffffu : (1u << half) - 1;
+    uint  k[4] = { keys.s0, keys.s1, keys.s2, keys.s3 };
+    ulong x = j;
+    do {
+        uint l = (uint)(x >> half);
+        uint r = (uint)x & mask;
+        for (int i = 0; i < 4; i++) {
+            uint t = l ^ (scatter_round(r, k[i]) & mask);
+            l = r;
+            r = t;
+        }
+        x = ((ulong)l << half) | r;
+    } while (x >= domain);
+    return x;
+}
+
+__kernel void encode_scatter_kernel(__global uchar* pixels,
+                                    __global const uchar* payload,
+                                    int n_carriers,
+                                    int body_len,
+                                    ulong domain,
+                                    uint half,
+                                    uint4 keys)
+{
+    int i = get_global_id(0);
+    if (i >= n_carriers) return;
+
+    if (i < HEADER_CARRIER) {
+        uchar bit = (payload[i >> 3] >> (i & 7)) & 1;
+        pixels[i] = (pixels[i] & 0xFE) | bit;
+        return;
+    }
+
+    __global const uchar* body = payload + 4;
+    int pos   = (i - HEADER_CARRIER) * BITS;
+    int byte  = pos >> 3;
+    int shift = pos & 7;
+
+    uint v = body[byte];
+    if (shift + BITS > 8 && byte + 1 < body_len)
+        v |= (uint)body[byte + 1] << 8;
+
+    ulong dst = HEADER_CARRIER
+              + scatter_index((ulong)(i - HEADER_CARRIER), domain, half, keys);
+    pixels[dst] = (uchar)((pixels[dst] & ~BITS_MASK) | ((v >> shift) & BITS_MASK));
+}
+
+__kernel void decode_frame_scatter_kernel(__global const uchar* pixels,
+                                          __global uchar* output,
+                                          int capacity,
+                                          ulong domain,
+                                          uint half,
+                                          uint4 keys)
+{
+    int byte_i = get_global_id(0);
+    if (byte_i >= capacity || byte_i >= frame_length(pixels)) return;
+
+    // Visit each carrier holding a bit of this byte once
+    int bit0  = byte_i * 8;
+    int first = bit0 / BITS;
+    int last  = (bit0 + 7) / BITS;
+    uint acc  = 0;
+
+    for (int c = first; c <= last; c++) {
+        ulong src = HEADER_CARRIER + scatter_index((ulong)c, domain, half, keys);
+        uint  v   = pixels[src] & BITS_MASK;
+        int   off = c * BITS - bit0;
+        acc |= off >= 0 ? v << off : v >> -off;
+    }
+
+    output[byte_i] = (uchar)acc;
+}
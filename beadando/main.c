@@ -1,10 +1,15 @@
 #include "common/image_io.h"
 #include "common/stego_types.h"
+#include "common/batch.h"
+#include "common/file_io.h"
 #include "common/benchmark.h"
-#include "common/filesystem_utils.h"
-#include "opencl/run_cl.h"
-#include "opencl/stego_opencl.h"
-#include "openmp/stego_openmp.h"
+#include "common/stego_utils.h"
+#include "common/stego_engine.h"
+#include "common/stego_stream.h"
+#include "common/pixel_buffer.h"
+#include "common/png_write.h"
+#include "openmp/stego_kernels.h"
+#include "opencl/program_cache.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,93 +20,174 @@ static void usage(const char *prog)
     fprintf(stderr,
             "Usage:\n"
             "  %s encode <carrier.ppm> <output.ppm> <message.txt>"
-            " [--omp|--ocl] [--threads N]\n"
+            " [--omp|--ocl] [--threads N] [--isa I] [--bits K]"
+            " [--numa P] [--hugepages on|off] [--auto] [--key K]"
+            " [--png-level L] [--cl-cache DIR|off] [--stream [--strip MB]]\n"
             "  %s decode <stego.ppm>   <output.txt>"
-            " [--omp|--ocl] [--threads N]\n"
-            "  %s bench  [n=<w>...] [p=<p>...] [t=<trials>] [-noplot]\n"
+            " [--omp|--ocl] [--threads N] [--isa I] [--numa P]"
+            " [--hugepages on|off] [--auto] [--key K] [--cl-cache DIR|off]"
+            " [--stream [--strip MB]]\n"
+            "  %s bench  [n=<w>...] [p=<p>...] [t=<trials>] [-noplot]"
+            " [--isa I] [--bits K] [--numa P] [--hugepages on|off]\n"
             "  %s gen    <width> <height> <output.ppm>\n"
+            "  %s batch  encode <carrier_dir> <output_dir> --message <msg.txt>"
+            " [flags]\n"
+            "  %s batch  decode <stego_dir>   <output_dir> [flags]\n"
+            "  %s batch  encode|decode --manifest <list.txt> [--message <msg.txt>]"
+            " [flags]\n"
+            "  %s calibrate  (re-measure the --auto cost model)\n"
             "\n"
-            "Defaults: --omp, --threads 0 (OMP_NUM_THREADS / system default)\n",
-            prog, prog, prog, prog);
+            "Defaults: --omp, --threads 0 (OMP_NUM_THREADS / system default)\n"
+            "          --isa auto (scalar|sse2|avx2|avx512, widest supported)\n"
+            "          --bits 1 (LSBs per channel byte, 1..4; decode reads it"
+            " from the header)\n"
+            "          --numa first-touch (none|first-touch|interleave)\n"
+            "          --hugepages on (2 MiB pages for large buffers)\n"
+            "          --auto picks backend and threads per call from a"
+            " per-host calibration\n"
+            "          --key scatters the body in a passphrase-keyed order"
+            " (decode needs the same key)\n"
+            "          --png-level 6 (PNG output: 0 = stored ... 9 = smallest)\n"
+            "          --cl-cache " CL_CACHE_DIR_DEFAULT
+            " (compiled OpenCL kernels; off = always rebuild)\n"
+            "          --stream processes a PPM in --strip 4 MiB strips"
+            " (bounded memory, no --key)\n"
+            "          batch: --threads N = worker pool size\n"
+            "          batch: --pipeline L:E:S overlaps load / encode|decode /"
+            " save with L, E and S threads\n",
+            prog, prog, prog, prog, prog, prog, prog, prog);
     exit(EXIT_FAILURE);
 }
 
-static int read_message_file(const char *path, StegoMessage *msg)
+/* Parse "--isa <name>" and install the matching kernel table. */
+static int select_isa(const char* name)
 {
-    FILE *f = fopen(path, "rb");
-    if (!f)
-    {
-        perror(path);
-        return -1;
-    }
-
-    fseek(f, 0, SEEK_END);
-    long sz = ftell(f);
-    rewind(f);
-
-    if (sz <= 0)
-    {
-        fclose(f);
-        fprintf(stderr, "Empty message file\n");
-        return -1;
-    }
-
-    msg->length = (size_t)sz;
-    msg->data = (uint8_t *)malloc((size_t)sz);
-    if (!msg->data)
-    {
-        fclose(f);
+    StegoIsa isa;
+    if (stego_isa_parse(name, &isa) != 0) {
+        fprintf(stderr, "Unknown ISA '%s'\n", name);
         return -1;
     }
-
-    if (fread(msg->data, 1, (size_t)sz, f) != (size_t)sz)
-    {
-        perror("fread");
-        fclose(f);
-        free(msg->data);
+    if (stego_kernels_select(isa) != 0) {
+        fprintf(stderr, "ISA '%s' is not supported on this CPU\n", name);
         return -1;
     }
-    fclose(f);
     return 0;
 }
 
-static int write_message_file(const char *path, const StegoMessage *msg)
+/* Parse "--numa <policy>" and make it the default for image buffers. */
+static int select_numa(const char* name)
 {
-    if (create_output_directories(path) != 0) {
-        fprintf(stderr, "Cannot create directory for '%s'\n", path);
+    NumaPolicy policy;
+    if (pixel_parse_numa_policy(name, &policy) != 0) {
+        fprintf(stderr, "Unknown NUMA policy '%s'\n", name);
         return -1;
     }
-    
-    FILE *f = fopen(path, "wb");
-    if (!f)
-    {
-        perror(path);
-        return -1;
-    }
-    if (fwrite(msg->data, 1, msg->length, f) != msg->length)
-    {
-        perror("fwrite");
-        fclose(f);
-        return -1;
-    }
-    fclose(f);
+    pixel_set_numa_policy(policy);
     return 0;
 }
 
-static void parse_backend_flags(int argc, char *argv[], int start,
-                                int *use_ocl, int *threads)
+static int parse_backend_flags(int argc, char *argv[], int start,
+                               int *use_ocl, int *threads, int *bits,
+                               int *auto_mode, const char **key)
 {
-    *use_ocl = 0;
-    *threads = 0;
+    *use_ocl   = 0;
+    *threads   = 0;
+    *bits      = 1;
+    *auto_mode = 0;
+    *key       = NULL;
     for (int i = start; i < argc; i++)
     {
-        if (strcmp(argv[i], "--ocl") == 0)
+        if (strcmp(argv[i], "--auto") == 0)
+            *auto_mode = 1;
+        else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+            *key = argv[++i];
+        else if (strcmp(argv[i], "--ocl") == 0)
             *use_ocl = 1;
         else if (strcmp(argv[i], "--omp") == 0)
             *use_ocl = 0;
         else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
             *threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc)
+        {
+            *bits = atoi(argv[++i]);
+            if (*bits < STEGO_MIN_BITS || *bits > STEGO_MAX_BITS)
+            {
+                fprintf(stderr, "--bits must be %d..%d\n",
+                        STEGO_MIN_BITS, STEGO_MAX_BITS);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc)
+        {
+            if (select_isa(argv[++i]) != 0)
+                return -1;
+        }
+        else if (strcmp(argv[i], "--hugepages") == 0 && i + 1 < argc)
+            pixel_set_huge_pages(strcmp(argv[++i], "off") != 0);
+        else if (strcmp(argv[i], "--numa") == 0 && i + 1 < argc)
+        {
+            if (select_numa(argv[++i]) != 0)
+                return -1;
+        }
+        else if (strcmp(argv[i], "--png-level") == 0 && i + 1 < argc)
+            png_set_level(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--cl-cache") == 0 && i + 1 < argc)
+            cl_set_cache_dir(argv[++i]);
+    }
+    return 0;
+}
+
+/*
+ * "--stream [--strip MB]": stream the PPM in strips instead of loading it.
+ * Returns 1 if streaming was requested (strip in bytes, 0 = default).
+ */
+static int parse_stream_flags(int argc, char *argv[], int start,
+                              size_t *strip)
+{
+    int stream = 0;
+    *strip = 0;
+    for (int i = start; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--stream") == 0)
+            stream = 1;
+        else if (strcmp(argv[i], "--strip") == 0 && i + 1 < argc)
+            *strip = (size_t)atol(argv[++i]) << 20;
+    }
+    return stream;
+}
+
+/* Fixed engine, or a model-driven one under --auto. */
+static int open_engine(StegoEngine *eng, AutotuneModel *model,
+                       int auto_mode, int use_ocl, int threads)
+{
+    if (!auto_mode)
+        return stego_engine_init(eng, threads, use_ocl);
+    if (autotune_init(model, 0) != 0)
+    {
+        fprintf(stderr, "[autotune] Calibration failed\n");
+        return -1;
     }
+    return stego_engine_init_auto(eng, model);
+}
+
+static void print_backend(int auto_mode, int use_ocl)
+{
+    printf("Backend: %s",
+           auto_mode ? "auto" : use_ocl ? "OpenCL" : "OpenMP");
+    if (!auto_mode && !use_ocl)
+        printf(" (%s)", stego_kernels()->name);
+    printf("\n");
+}
+
+static void print_plan(const StegoEngine *eng)
+{
+    if (!eng->model)
+        return;
+    if (eng->last_ocl)
+        printf("[autotune] Chose OpenCL\n");
+    else
+        printf("[autotune] Chose OpenMP (%s), %d thread(s)\n",
+               stego_kernels()->name, eng->last_threads);
 }
 
 int main(int argc, char *argv[])
@@ -124,6 +210,125 @@ int main(int argc, char *argv[])
         return ret ? EXIT_FAILURE : EXIT_SUCCESS;
     }
 
+    /* ================================================================
+     * batch  encode|decode  <in_dir> <out_dir> | --manifest <file>
+     * ================================================================ */
+    if (strcmp(argv[1], "batch") == 0)
+    {
+        if (argc < 5)
+            usage(argv[0]);
+
+        BatchConfig bc;
+        memset(&bc, 0, sizeof(bc));
+        if (strcmp(argv[2], "encode") == 0)
+            bc.op = BATCH_ENCODE;
+        else if (strcmp(argv[2], "decode") == 0)
+            bc.op = BATCH_DECODE;
+        else
+            usage(argv[0]);
+
+        int auto_mode;
+        if (parse_backend_flags(argc, argv, 5, &bc.use_ocl, &bc.workers,
+                                &bc.bits, &auto_mode, &bc.key) != 0)
+            return EXIT_FAILURE;
+        for (int i = 5; i + 1 < argc; i++)
+        {
+            if (strcmp(argv[i], "--message") == 0)
+                bc.message = argv[i + 1];
+            else if (strcmp(argv[i], "--pipeline") == 0
+                     && (sscanf(argv[i + 1], "%d:%d:%d", &bc.pipe_load,
+                                &bc.pipe_work, &bc.pipe_save) != 3
+                         || bc.pipe_load < 1 || bc.pipe_work < 1
+                         || bc.pipe_save < 1))
+            {
+                fprintf(stderr, "--pipeline expects L:E:S thread counts, "
+                                "e.g. 1:4:1\n");
+                return EXIT_FAILURE;
+            }
+        }
+
+        BatchList list = { NULL, 0, 0 };
+        int ret = strcmp(argv[3], "--manifest") == 0
+                ? batch_load_manifest(&list, bc.op, argv[4])
+                : batch_scan_dir(&list, bc.op, argv[3], argv[4]);
+        if (ret != 0)
+        {
+            batch_list_free(&list);
+            return EXIT_FAILURE;
+        }
+
+        AutotuneModel model;
+        if (auto_mode)
+        {
+            if (autotune_init(&model, 0) != 0)
+            {
+                batch_list_free(&list);
+                return EXIT_FAILURE;
+            }
+            bc.model = &model;
+        }
+
+        printf("[batch] %s %d file(s) | ", argv[2], list.count);
+        print_backend(auto_mode, bc.use_ocl);
+
+        BatchStats st;
+        ret = batch_run(&list, &bc, &st);
+        batch_list_free(&list);
+
+        double secs = st.seconds > 0.0 ? st.seconds : 1e-9;
+        printf("[batch] %d done, %d failed in %.3f s | %.1f images/s | "
+               "%.1f MB/s | I/O: %s\n",
+               st.done, st.failed, st.seconds, st.done / secs,
+               st.bytes / secs / 1e6, file_io_backend());
+        if (bc.pipe_load > 0)
+        {
+            static const char *stage[3] = { "load", NULL, "save" };
+            int neck = 0;
+            for (int s = 1; s < 3; s++)
+                if (st.stage_util[s] > st.stage_util[neck])
+                    neck = s;
+            printf("[batch] pipeline");
+            for (int s = 0; s < 3; s++)
+                printf(" | %s: %d thr %.0f%%", stage[s] ? stage[s] : argv[2],
+                       st.stage_threads[s], st.stage_util[s] * 100.0);
+            printf(" | bottleneck: %s\n",
+                   stage[neck] ? stage[neck] : argv[2]);
+        }
+        return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    /* ================================================================
+     * calibrate
+     * ================================================================ */
+    if (strcmp(argv[1], "calibrate") == 0)
+    {
+        AutotuneModel model;
+        if (autotune_init(&model, 1) != 0)
+            return EXIT_FAILURE;
+
+        for (int op = 0; op < 2; op++)
+        {
+            printf("%s:\n", op == AUTOTUNE_ENCODE ? "encode" : "decode");
+            for (int cls = 0; cls < AUTOTUNE_CLASSES; cls++)
+            {
+                int bits = cls / 2 + 1, keyed = cls & 1;
+                printf("  k=%d %-5s", bits, keyed ? "keyed" : "seq");
+                for (int s = 0; s < AUTOTUNE_SIZES; s++)
+                {
+                    const AutotuneConfig *c = autotune_pick(
+                        &model, (AutotuneOp)op, bits, keyed, model.sizes[s]);
+                    if (c->use_ocl)
+                        printf(" | %zuK OpenCL", model.sizes[s] >> 10);
+                    else
+                        printf(" | %zuK OpenMP x%d", model.sizes[s] >> 10,
+                               c->threads);
+                }
+                printf("\n");
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
     /* ================================================================
      * gen  <width> <height> <output.ppm>
      * ================================================================ */
@@ -151,45 +356,67 @@ int main(int argc, char *argv[])
         if (argc < 5)
             usage(argv[0]);
 
-        int use_ocl, threads;
-        parse_backend_flags(argc, argv, 5, &use_ocl, &threads);
+        int use_ocl, threads, bits, auto_mode;
+        const char *key;
+        if (parse_backend_flags(argc, argv, 5, &use_ocl, &threads, &bits,
+                                &auto_mode, &key) != 0)
+            return EXIT_FAILURE;
+
+        size_t strip;
+        if (parse_stream_flags(argc, argv, 5, &strip))
+        {
+            if (key)
+            {
+                fprintf(stderr, "--stream cannot be combined with --key\n");
+                return EXIT_FAILURE;
+            }
+            StegoMessage msg;
+            if (stego_message_load(argv[4], &msg) != 0)
+                return EXIT_FAILURE;
+            printf("Message: %zu bytes | Backend: stream (%s)\n",
+                   msg.length, stego_kernels()->name);
+            int ret = stego_stream_encode(argv[2], argv[3], &msg, bits, strip);
+            if (ret == 0)
+                printf("Output saved: %s\n", argv[3]);
+            stego_message_free(&msg);
+            return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
 
         Image carrier;
-        if (image_load(argv[2], &carrier) != 0)
+        if (image_map(argv[2], &carrier, IMAGE_MAP_PRIVATE) != 0)
             return EXIT_FAILURE;
 
         StegoMessage msg;
-        if (read_message_file(argv[4], &msg) != 0)
+        if (stego_message_load(argv[4], &msg) != 0)
         {
             image_free(&carrier);
             return EXIT_FAILURE;
         }
 
-        printf("Carrier: %dx%d (%zu bytes capacity)\n",
-               carrier.width, carrier.height, stego_capacity_bytes(&carrier));
-        printf("Message: %zu bytes | Backend: %s\n",
-               msg.length, use_ocl ? "OpenCL" : "OpenMP");
+        printf("Carrier: %dx%d (%zu bytes capacity at k=%d)\n",
+               carrier.width, carrier.height,
+               stego_capacity_bytes(&carrier, bits), bits);
+        printf("Message: %zu bytes | ", msg.length);
+        print_backend(auto_mode, use_ocl);
 
-        int ret;
-        if (use_ocl)
+        StegoEngine eng;
+        AutotuneModel model;
+        if (open_engine(&eng, &model, auto_mode, use_ocl, threads) != 0)
         {
-            CLContext ctx;
-            if (cl_init(&ctx) != 0)
-            {
-                stego_message_free(&msg);
-                image_free(&carrier);
-                return EXIT_FAILURE;
-            }
-            ret = stego_encode_ocl(&ctx, &carrier, &msg);
-            cl_cleanup(&ctx);
-        }
-        else
-        {
-            ret = stego_encode_omp(&carrier, &msg, threads);
+            stego_message_free(&msg);
+            image_free(&carrier);
+            return EXIT_FAILURE;
         }
+        stego_engine_set_key(&eng, key);
+        int ret = stego_engine_encode(&eng, &carrier, &msg, bits);
+        size_t dirty_begin = eng.dirty_begin, dirty_end = eng.dirty_end;
+        print_plan(&eng);
+        stego_engine_destroy(&eng);
 
         if (ret == 0) {
-            ret = image_save(argv[3], &carrier);
+            /* PPM -> PPM: clone the carrier file, rewrite the changed bytes */
+            ret = image_save_ppm_patch(argv[3], argv[2], &carrier,
+                                       dirty_begin, dirty_end, 0);
             if (ret == 0) printf("Output saved: %s\n", argv[3]);
         }
 
@@ -206,42 +433,62 @@ int main(int argc, char *argv[])
         if (argc < 4)
             usage(argv[0]);
 
-        int use_ocl, threads;
-        parse_backend_flags(argc, argv, 4, &use_ocl, &threads);
-
-        Image stego;
-        if (image_load(argv[2], &stego) != 0)
+        int use_ocl, threads, bits, auto_mode;
+        const char *key;
+        if (parse_backend_flags(argc, argv, 4, &use_ocl, &threads, &bits,
+                                &auto_mode, &key) != 0)
             return EXIT_FAILURE;
 
-        printf("Stego image: %dx%d | Backend: %s\n",
-               stego.width, stego.height, use_ocl ? "OpenCL" : "OpenMP");
-
-        StegoMessage msg = {NULL, 0};
-        int ret;
-        if (use_ocl)
+        size_t strip;
+        if (parse_stream_flags(argc, argv, 4, &strip))
         {
-            CLContext ctx;
-            if (cl_init(&ctx) != 0)
+            if (key)
             {
-                image_free(&stego);
+                fprintf(stderr, "--stream cannot be combined with --key\n");
                 return EXIT_FAILURE;
             }
-            ret = stego_decode_ocl(&ctx, &stego, &msg);
-            cl_cleanup(&ctx);
+            printf("Backend: stream (%s)\n", stego_kernels()->name);
+            StegoMessage msg;
+            int ret = stego_stream_decode(argv[2], &msg, strip);
+            if (ret == 0)
+            {
+                ret = stego_message_save(argv[3], &msg);
+                if (ret == 0)
+                    printf("Decoded %zu bytes → %s\n", msg.length, argv[3]);
+                stego_message_free(&msg);
+            }
+            return ret ? EXIT_FAILURE : EXIT_SUCCESS;
         }
-        else
+
+        Image stego;
+        if (image_map(argv[2], &stego, IMAGE_MAP_READ) != 0)
+            return EXIT_FAILURE;
+
+        printf("Stego image: %dx%d | ", stego.width, stego.height);
+        print_backend(auto_mode, use_ocl);
+
+        StegoEngine eng;
+        AutotuneModel model;
+        if (open_engine(&eng, &model, auto_mode, use_ocl, threads) != 0)
         {
-            ret = stego_decode_omp(&stego, &msg, threads);
+            image_free(&stego);
+            return EXIT_FAILURE;
         }
 
+        const uint8_t* data;
+        size_t length;
+        stego_engine_set_key(&eng, key);
+        int ret = stego_engine_decode(&eng, &stego, &data, &length);
+        print_plan(&eng);
         if (ret == 0)
         {
-            ret = write_message_file(argv[3], &msg);
+            StegoMessage msg = { (uint8_t *)data, length };
+            ret = stego_message_save(argv[3], &msg);
             if (ret == 0)
                 printf("Decoded %zu bytes → %s\n", msg.length, argv[3]);
         }
 
-        stego_message_free(&msg);
+        stego_engine_destroy(&eng);
         image_free(&stego);
         return ret ? EXIT_FAILURE : EXIT_SUCCESS;
     }
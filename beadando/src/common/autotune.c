@@ -0,0 +1,361 @@
+#if !defined(_WIN32)
+#  define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "common/autotune.h"
+#include "common/benchmark.h"
+#include "common/filesystem_utils.h"
+#include "common/image_io.h"
+#include "common/stego_scatter.h"
+#include "opencl/stego_opencl.h"
+#include "openmp/stego_kernels.h"
+#include "openmp/stego_openmp.h"
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#  include <unistd.h>
+#endif
+
+#define CACHE_MAGIC   "stego-autotune 2"
+#define CALIB_SIDE    1700   /* 1700x1700x3 carrier holds a 1 MiB payload */
+#define CALIB_REPEATS 3
+#define CALIB_LONG    0.02   /* s: one sample is enough for slower calls */
+#define CALIB_KEY     "autotune"   /* any passphrase: only the order's cost matters */
+
+static const size_t calib_sizes[AUTOTUNE_SIZES] = {
+    1024, 16 * 1024, 256 * 1024, 1024 * 1024
+};
+
+/* Identity of the host a cache entry was measured on */
+static void host_key(char* buf, size_t size)
+{
+    char host[128] = "unknown";
+#if defined(_WIN32)
+    const char* env = getenv("COMPUTERNAME");
+    if (env) snprintf(host, sizeof(host), "%s", env);
+#else
+    if (gethostname(host, sizeof(host)) != 0)
+        snprintf(host, sizeof(host), "unknown");
+    host[sizeof(host) - 1] = '\0';
+#endif
+    snprintf(buf, size, "host %s cpus %d isa %s",
+             host, omp_get_num_procs(), stego_kernels()->name);
+}
+
+void autotune_cache_path(char* buf, size_t size)
+{
+    const char* env = getenv("STEGO_AUTOTUNE_CACHE");
+    if (env && *env) {
+        snprintf(buf, size, "%s", env);
+        return;
+    }
+#if defined(_WIN32)
+    const char* base = getenv("LOCALAPPDATA");
+    if (base) {
+        snprintf(buf, size, "%s\\stego\\autotune.cache", base);
+        return;
+    }
+#else
+    const char* xdg  = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && *xdg) {
+        snprintf(buf, size, "%s/stego/autotune.cache", xdg);
+        return;
+    }
+    if (home && *home) {
+        snprintf(buf, size, "%s/.cache/stego/autotune.cache", home);
+        return;
+    }
+#endif
+    snprintf(buf, size, "data/results/autotune.cache");
+}
+
+/* ======================================================================
+ * Calibration
+ * ====================================================================== */
+
+/* Model slot of the (k, order) class */
+static int class_of(int bits, int keyed)
+{
+    return (bits - 1) * 2 + (keyed != 0);
+}
+
+static double time_call(AutotuneOp op, const AutotuneConfig* cfg,
+                        CLContext* cl, Image* carrier,
+                        const StegoSegment* part, int bits,
+                        const StegoKey* key, uint8_t** buf, size_t* cap)
+{
+    double best = -1.0;
+    for (int r = 0; r < CALIB_REPEATS; r++) {
+        size_t len;
+        int ret;
+        double t0 = get_time();
+        if (op == AUTOTUNE_ENCODE)
+            ret = cfg->use_ocl
+                ? stego_encode_ocl_keyed(cl, carrier, part, 1, bits, key)
+                : stego_encode_omp_keyed(carrier, part, 1, bits, key,
+                                         cfg->threads);
+        else
+            ret = cfg->use_ocl
+                ? stego_decode_ocl_keyed_into(cl, carrier, key, buf, cap, &len)
+                : stego_decode_omp_keyed_into(carrier, key, buf, cap, &len,
+                                              cfg->threads);
+        double dt = get_time() - t0;
+        if (ret != 0)
+            return -1.0;
+        if (best < 0.0 || dt < best)
+            best = dt;
+        if (dt > CALIB_LONG)
+            break;
+    }
+    return best;
+}
+
+/* OMP candidates 1, 2, 4, ... plus the CPU count, then OpenCL */
+static int candidate_configs(AutotuneConfig* out, int with_ocl)
+{
+    int n = 0, procs = omp_get_num_procs();
+    for (int p = 1; p < procs && n < AUTOTUNE_MAX_CONFIGS - 2; p *= 2)
+        out[n++] = (AutotuneConfig){ 0, p, {0} };
+    out[n++] = (AutotuneConfig){ 0, procs, {0} };
+    if (with_ocl)
+        out[n++] = (AutotuneConfig){ 1, 0, {0} };
+    return n;
+}
+
+int autotune_calibrate(AutotuneModel* model, CLContext* cl)
+{
+    memset(model, 0, sizeof(*model));
+    memcpy(model->sizes, calib_sizes, sizeof(calib_sizes));
+
+    Image carrier;
+    if (image_alloc(&carrier, CALIB_SIDE, CALIB_SIDE, 3) != 0)
+        return -1;
+    size_t n_pixels = (size_t)CALIB_SIDE * CALIB_SIDE * 3;
+    for (size_t i = 0; i < n_pixels; i++)
+        carrier.pixels[i] = (uint8_t)(i * 2654435761u >> 24);
+
+    StegoMessage msg;
+    msg.length = calib_sizes[AUTOTUNE_SIZES - 1];
+    msg.data   = (uint8_t*)malloc(msg.length);
+    if (!msg.data) {
+        image_free(&carrier);
+        return -1;
+    }
+    for (size_t i = 0; i < msg.length; i++)
+        msg.data[i] = (uint8_t)('A' + i % 26);
+
+    StegoKey key;
+    stego_key_derive(&key, CALIB_KEY);
+
+    uint8_t* buf = NULL;
+    size_t   cap = 0;
+    int      ret = 0;
+    int      ocl = cl != NULL;
+
+    for (int cls = 0; cls < AUTOTUNE_CLASSES && ret == 0; cls++) {
+        int             bits  = cls / 2 + 1;
+        const StegoKey* order = (cls & 1) ? &key : NULL;
+
+        for (int op = 0; op < 2 && ret == 0; op++) {
+            AutotuneConfig* cfgs = model->configs[cls][op];
+            int n = candidate_configs(cfgs, ocl);
+
+            for (int s = 0; s < AUTOTUNE_SIZES && ret == 0; s++) {
+                StegoSegment part = { msg.data, calib_sizes[s] };
+                if (op == AUTOTUNE_DECODE)
+                    stego_encode_omp_keyed(&carrier, &part, 1, bits, order, 0);
+
+                for (int c = 0; c < n; c++) {
+                    double t = time_call((AutotuneOp)op, &cfgs[c], cl,
+                                         &carrier, &part, bits, order,
+                                         &buf, &cap);
+                    if (t < 0.0 && cfgs[c].use_ocl) {
+                        /* Device failed mid-calibration: drop OpenCL */
+                        n--;
+                        ocl = 0;
+                        continue;
+                    }
+                    if (t < 0.0) { ret = -1; break; }
+                    cfgs[c].time[s] = t;
+                }
+            }
+            model->n_configs[cls][op] = n;
+        }
+    }
+
+    free(buf);
+    free(msg.data);
+    image_free(&carrier);
+    return ret;
+}
+
+/* ======================================================================
+ * Cache file
+ * ====================================================================== */
+
+static int autotune_save(const AutotuneModel* model, const char* path)
+{
+    if (create_output_directories(path) != 0)
+        return -1;
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+
+    char key[256];
+    host_key(key, sizeof(key));
+    fprintf(f, "%s\n%s\n", CACHE_MAGIC, key);
+
+    fprintf(f, "sizes");
+    for (int s = 0; s < AUTOTUNE_SIZES; s++)
+        fprintf(f, " %zu", model->sizes[s]);
+    fprintf(f, "\n");
+
+    for (int cls = 0; cls < AUTOTUNE_CLASSES; cls++) {
+        for (int op = 0; op < 2; op++) {
+            for (int c = 0; c < model->n_configs[cls][op]; c++) {
+                const AutotuneConfig* cfg = &model->configs[cls][op][c];
+                fprintf(f, "%s %d %s %s %d",
+                        op == AUTOTUNE_ENCODE ? "encode" : "decode",
+                        cls / 2 + 1, (cls & 1) ? "keyed" : "seq",
+                        cfg->use_ocl ? "ocl" : "omp", cfg->threads);
+                for (int s = 0; s < AUTOTUNE_SIZES; s++)
+                    fprintf(f, " %.9f", cfg->time[s]);
+                fprintf(f, "\n");
+            }
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int autotune_load(AutotuneModel* model, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+
+    char line[512], key[256];
+    host_key(key, sizeof(key));
+    memset(model, 0, sizeof(*model));
+
+    if (!fgets(line, sizeof(line), f) || strncmp(line, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0)
+        goto stale;
+    if (!fgets(line, sizeof(line), f))
+        goto stale;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strcmp(line, key) != 0)             /* whole line: no prefix matches */
+        goto stale;
+    if (fscanf(f, " sizes %zu %zu %zu %zu", &model->sizes[0], &model->sizes[1],
+               &model->sizes[2], &model->sizes[3]) != AUTOTUNE_SIZES)
+        goto stale;
+
+    char op_name[16], order[16], backend[16];
+    int  bits;
+    AutotuneConfig cfg;
+    while (fscanf(f, " %15s %d %15s %15s %d %lf %lf %lf %lf", op_name, &bits,
+                  order, backend, &cfg.threads, &cfg.time[0], &cfg.time[1],
+                  &cfg.time[2], &cfg.time[3]) == 5 + AUTOTUNE_SIZES) {
+        int op  = strcmp(op_name, "encode") == 0 ? AUTOTUNE_ENCODE
+                                                 : AUTOTUNE_DECODE;
+        if (bits < 1 || bits > AUTOTUNE_BITS)
+            goto stale;
+        int cls = class_of(bits, strcmp(order, "keyed") == 0);
+        if (model->n_configs[cls][op] >= AUTOTUNE_MAX_CONFIGS)
+            goto stale;
+        cfg.use_ocl = strcmp(backend, "ocl") == 0;
+        model->configs[cls][op][model->n_configs[cls][op]++] = cfg;
+    }
+    fclose(f);
+
+    /* every class must be present, or the cache predates a class */
+    for (int cls = 0; cls < AUTOTUNE_CLASSES; cls++)
+        if (model->n_configs[cls][0] == 0 || model->n_configs[cls][1] == 0)
+            return -1;
+    return 0;
+
+stale:
+    fclose(f);
+    return -1;
+}
+
+int autotune_init(AutotuneModel* model, int refresh)
+{
+    char path[512];
+    autotune_cache_path(path, sizeof(path));
+
+    if (!refresh && autotune_load(model, path) == 0)
+        return 0;
+
+    printf("[autotune] Calibrating this host (one-off)...\n");
+    CLContext cl;
+    int with_ocl = cl_init(&cl) == 0;
+
+    int ret = autotune_calibrate(model, with_ocl ? &cl : NULL);
+    if (with_ocl)
+        cl_cleanup(&cl);
+    if (ret != 0)
+        return -1;
+
+    if (autotune_save(model, path) == 0)
+        printf("[autotune] Model cached in %s\n", path);
+    else
+        fprintf(stderr, "[autotune] Could not write cache '%s'\n", path);
+    return 0;
+}
+
+/* ======================================================================
+ * Cost model
+ * ====================================================================== */
+
+double autotune_predict(const AutotuneModel* model, const AutotuneConfig* cfg,
+                        size_t bytes)
+{
+    const size_t* x = model->sizes;
+    const double* y = cfg->time;
+
+    if (bytes <= x[0])
+        return y[0];
+
+    /* Interpolate between neighbours; extrapolate with the last slope */
+    int i = 1;
+    while (i < AUTOTUNE_SIZES - 1 && bytes > x[i])
+        i++;
+    double slope = (y[i] - y[i - 1]) / (double)(x[i] - x[i - 1]);
+    double t = y[i - 1] + slope * (double)(bytes - x[i - 1]);
+    return t > 0.0 ? t : y[i - 1];
+}
+
+const AutotuneConfig* autotune_pick(const AutotuneModel* model, AutotuneOp op,
+                                    int bits, int keyed, size_t bytes)
+{
+    if (bits < 1 || bits > AUTOTUNE_BITS)
+        return NULL;
+
+    int cls = class_of(bits, keyed);
+    const AutotuneConfig* best = NULL;
+    double best_t = 0.0;
+    for (int c = 0; c < model->n_configs[cls][op]; c++) {
+        const AutotuneConfig* cfg = &model->configs[cls][op][c];
+        if (cfg->use_ocl && bytes > STEGO_OCL_MAX_LENGTH)
+            continue;                   /* past what the kernels index */
+        double t = autotune_predict(model, cfg, bytes);
+        if (!best || t < best_t) {
+            best   = cfg;
+            best_t = t;
+        }
+    }
+    return best;
+}
+
+int autotune_has_ocl(const AutotuneModel* model)
+{
+    for (int cls = 0; cls < AUTOTUNE_CLASSES; cls++)
+        for (int op = 0; op < 2; op++)
+            for (int c = 0; c < model->n_configs[cls][op]; c++)
+                if (model->configs[cls][op][c].use_ocl)
+                    return 1;
+    return 0;
+}
@@ -0,0 +1,644 @@
+#if !defined(_WIN32)
+#  define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "common/batch.h"
+#include "common/benchmark.h"
+#include "common/filesystem_utils.h"
+#include "common/image_io.h"
+#include "common/pixel_buffer.h"
+#include "common/stego_engine.h"
+#include "common/stego_utils.h"
+#include "openmp/stego_kernels.h"
+
+#include <ctype.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+/* Files at least this large get the whole team inside the image */
+#define BATCH_LARGE_BYTES (8u << 20)
+
+/* ======================================================================
+ * Job list
+ * ====================================================================== */
+
+static char* dup_string(const char* s)
+{
+    char* d = (char*)malloc(strlen(s) + 1);
+    if (d) strcpy(d, s);
+    return d;
+}
+
+static size_t file_size(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+static int has_image_ext(const char* name)
+{
+    const char* ext = strrchr(name, '.');
+    char lower[8];
+    size_t i;
+    if (!ext || strlen(ext) >= sizeof(lower)) return 0;
+    for (i = 0; ext[i]; i++)
+        lower[i] = (char)tolower((unsigned char)ext[i]);
+    lower[i] = '\0';
+    return strcmp(lower, ".ppm") == 0 || strcmp(lower, ".png") == 0
+        || strcmp(lower, ".qoi") == 0;
+}
+
+static int batch_add(BatchList* list, const char* input, const char* output,
+                     const char* message)
+{
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 64;
+        BatchJob* grown = (BatchJob*)realloc(list->jobs,
+                                             (size_t)cap * sizeof(BatchJob));
+        if (!grown) return -1;
+        list->jobs = grown;
+        list->cap  = cap;
+    }
+
+    BatchJob* job   = &list->jobs[list->count];
+    job->input      = dup_string(input);
+    job->output     = dup_string(output);
+    job->message    = message ? dup_string(message) : NULL;
+    job->input_size = file_size(input);
+    if (!job->input || !job->output || (message && !job->message)) {
+        free(job->input);
+        free(job->output);
+        free(job->message);
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+int batch_scan_dir(BatchList* list, BatchOp op, const char* in_dir,
+                   const char* out_dir)
+{
+    char** names;
+    int    count;
+    if (list_directory_files(in_dir, &names, &count) != 0) {
+        fprintf(stderr, "[batch] Cannot list directory '%s'\n", in_dir);
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < count && ret == 0; i++) {
+        if (!has_image_ext(names[i])) continue;
+
+        char input[4096], output[4096];
+        snprintf(input, sizeof(input), "%s/%s", in_dir, names[i]);
+        if (op == BATCH_ENCODE)
+            snprintf(output, sizeof(output), "%s/%s", out_dir, names[i]);
+        else
+            snprintf(output, sizeof(output), "%s/%s.txt", out_dir, names[i]);
+        ret = batch_add(list, input, output, NULL);
+    }
+
+    free_directory_listing(names, count);
+    return ret;
+}
+
+int batch_load_manifest(BatchList* list, BatchOp op, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "[batch] Cannot open manifest '%s'\n", path);
+        return -1;
+    }
+
+    char line[3 * 4096];
+    int  line_no = 0, ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), f)) {
+        line_no++;
+        char* fields[4];
+        int   n = 0;
+        for (char* tok = strtok(line, " \t\r\n"); tok && n < 4;
+             tok = strtok(NULL, " \t\r\n"))
+            fields[n++] = tok;
+
+        if (n == 0 || fields[0][0] == '#') continue;
+        if (n < 2 || n > (op == BATCH_ENCODE ? 3 : 2)) {
+            fprintf(stderr, "[batch] %s:%d: expected %s\n", path, line_no,
+                    op == BATCH_ENCODE ? "<carrier> <output> [<message>]"
+                                       : "<stego> <output>");
+            ret = -1;
+            break;
+        }
+        ret = batch_add(list, fields[0], fields[1], n == 3 ? fields[2] : NULL);
+    }
+
+    fclose(f);
+    return ret;
+}
+
+void batch_list_free(BatchList* list)
+{
+    for (int i = 0; i < list->count; i++) {
+        free(list->jobs[i].input);
+        free(list->jobs[i].output);
+        free(list->jobs[i].message);
+    }
+    free(list->jobs);
+    list->jobs  = NULL;
+    list->count = 0;
+    list->cap   = 0;
+}
+
+/* ======================================================================
+ * One job
+ * ====================================================================== */
+
+static int run_job(StegoEngine* eng, const BatchConfig* cfg,
+                   const BatchJob* job, const StegoMessage* shared,
+                   size_t* bytes)
+{
+    Image img;
+    ImageMapMode mode = cfg->op == BATCH_ENCODE ? IMAGE_MAP_PRIVATE
+                                                : IMAGE_MAP_READ;
+    if (image_map(job->input, &img, mode) != 0)
+        return -1;
+    *bytes = (size_t)img.width * img.height * img.channels;
+
+    int ret;
+    if (cfg->op == BATCH_ENCODE) {
+        StegoMessage own = { NULL, 0 };
+        const StegoMessage* msg = shared;
+        if (job->message) {
+            if (stego_message_load(job->message, &own) != 0) {
+                image_free(&img);
+                return -1;
+            }
+            msg = &own;
+        }
+        ret = stego_engine_encode(eng, &img, msg, cfg->bits);
+        if (ret == 0)
+            ret = image_save_ppm_patch(job->output, job->input, &img,
+                                       eng->dirty_begin, eng->dirty_end, 0);
+        stego_message_free(&own);
+    } else {
+        const uint8_t* data;
+        size_t length;
+        ret = stego_engine_decode(eng, &img, &data, &length);
+        if (ret == 0) {
+            StegoMessage msg = { (uint8_t*)data, length };
+            ret = stego_message_save(job->output, &msg);
+        }
+    }
+
+    image_free(&img);
+    if (ret != 0)
+        fprintf(stderr, "[batch] Failed: %s\n", job->input);
+    return ret;
+}
+
+static void account(BatchStats* stats, int ok, size_t bytes)
+{
+    if (!ok) return;
+    #pragma omp atomic
+    stats->done++;
+    #pragma omp atomic
+    stats->bytes += bytes;
+}
+
+/* ======================================================================
+ * Work-stealing pool
+ *
+ * Each worker owns a contiguous range of small jobs and takes from its
+ * front.  An idle worker steals the back half of another worker's range.
+ * Jobs are never added after start, so a worker that finds every range
+ * empty can exit.
+ * ====================================================================== */
+
+typedef struct {
+    omp_lock_t lock;
+    int        head;
+    int        tail;
+    char       pad[64];     /* keep neighbouring ranges off one line */
+} WorkRange;
+
+static int range_pop(WorkRange* r, int* slot)
+{
+    int ok = 0;
+    omp_set_lock(&r->lock);
+    if (r->head < r->tail) {
+        *slot = r->head++;
+        ok = 1;
+    }
+    omp_unset_lock(&r->lock);
+    return ok;
+}
+
+static int range_steal(WorkRange* ranges, int n, int self)
+{
+    for (int d = 1; d < n; d++) {
+        WorkRange* victim = &ranges[(self + d) % n];
+        omp_set_lock(&victim->lock);
+        int avail = victim->tail - victim->head;
+        if (avail > 0) {
+            int hi = victim->tail;
+            int lo = hi - (avail + 1) / 2;
+            victim->tail = lo;
+            omp_unset_lock(&victim->lock);
+
+            omp_set_lock(&ranges[self].lock);
+            ranges[self].head = lo;
+            ranges[self].tail = hi;
+            omp_unset_lock(&ranges[self].lock);
+            return 1;
+        }
+        omp_unset_lock(&victim->lock);
+    }
+    return 0;
+}
+
+/* Next slot for worker `self`: own range first, then steal */
+static int next_job(WorkRange* ranges, int n, int self, int* slot)
+{
+    for (;;) {
+        if (range_pop(&ranges[self], slot))
+            return 1;
+        if (!range_steal(ranges, n, self))
+            return 0;
+    }
+}
+
+static int open_engine(StegoEngine* eng, const BatchConfig* cfg, int threads,
+                       const AutotuneModel* model)
+{
+    int ret = model ? stego_engine_init_auto(eng, model)
+                    : stego_engine_init(eng, threads, cfg->use_ocl);
+    if (ret != 0)
+        return -1;
+    if (stego_engine_set_key(eng, cfg->key) != 0) {
+        stego_engine_destroy(eng);
+        return -1;
+    }
+    return 0;
+}
+
+/* ======================================================================
+ * Pipelined executor
+ *
+ * Load threads read whole rasters (no mapping, so the I/O happens in the
+ * load stage), one driver thread runs the engine with a team of
+ * pipe_work threads, and save threads write the results.  Slots carry a
+ * job between stages; a full queue stalls its producer, so at most
+ * pipe_load + 2 * BATCH_QUEUE_DEPTH + 1 + pipe_save images are alive.
+ * OpenMP has no condition variables: a blocked thread backs off with a
+ * short sleep, which is not counted as busy time.
+ * ====================================================================== */
+
+typedef struct {
+    Image        img;
+    StegoMessage msg;           /* encode: own message; decode: result */
+    size_t       dirty_begin;
+    size_t       dirty_end;
+    size_t       bytes;
+} PipeSlot;
+
+typedef struct {
+    omp_lock_t lock;
+    int        ring[BATCH_QUEUE_DEPTH];
+    int        head;
+    int        count;
+    int        producers;       /* running producers; 0 + empty = drained */
+} PipeQueue;
+
+static void stage_pause(void)
+{
+#if defined(_WIN32)
+    Sleep(0);
+#else
+    struct timespec ts = { 0, 50 * 1000 };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static void queue_init(PipeQueue* q, int producers)
+{
+    omp_init_lock(&q->lock);
+    q->head      = 0;
+    q->count     = 0;
+    q->producers = producers;
+}
+
+/* Append slot, waiting while the queue is full */
+static void queue_push(PipeQueue* q, int slot)
+{
+    for (;;) {
+        omp_set_lock(&q->lock);
+        if (q->count < BATCH_QUEUE_DEPTH) {
+            q->ring[(q->head + q->count++) % BATCH_QUEUE_DEPTH] = slot;
+            omp_unset_lock(&q->lock);
+            return;
+        }
+        omp_unset_lock(&q->lock);
+        stage_pause();
+    }
+}
+
+/* Next slot, waiting while empty.  Returns 0 once every producer is done */
+static int queue_pop(PipeQueue* q, int* slot)
+{
+    for (;;) {
+        omp_set_lock(&q->lock);
+        if (q->count > 0) {
+            *slot   = q->ring[q->head];
+            q->head = (q->head + 1) % BATCH_QUEUE_DEPTH;
+            q->count--;
+            omp_unset_lock(&q->lock);
+            return 1;
+        }
+        int drained = q->producers == 0;
+        omp_unset_lock(&q->lock);
+        if (drained)
+            return 0;
+        stage_pause();
+    }
+}
+
+static void queue_close(PipeQueue* q)
+{
+    omp_set_lock(&q->lock);
+    q->producers--;
+    omp_unset_lock(&q->lock);
+}
+
+static void slot_free(PipeSlot* slot)
+{
+    image_free(&slot->img);
+    stego_message_free(&slot->msg);
+}
+
+static void pipe_failed(const BatchJob* job)
+{
+    fprintf(stderr, "[batch] Failed: %s\n", job->input);
+}
+
+static int pipe_load(const BatchConfig* cfg, const BatchJob* job,
+                     PipeSlot* slot)
+{
+    if (image_load(job->input, &slot->img) != 0)
+        return -1;
+    slot->bytes = (size_t)slot->img.width * slot->img.height
+                * slot->img.channels;
+    if (cfg->op == BATCH_ENCODE && job->message
+        && stego_message_load(job->message, &slot->msg) != 0) {
+        image_free(&slot->img);
+        return -1;
+    }
+    return 0;
+}
+
+static int pipe_work(StegoEngine* eng, const BatchConfig* cfg,
+                     const BatchJob* job, const StegoMessage* shared,
+                     PipeSlot* slot)
+{
+    if (cfg->op == BATCH_ENCODE) {
+        const StegoMessage* msg = job->message ? &slot->msg : shared;
+        if (stego_engine_encode(eng, &slot->img, msg, cfg->bits) != 0)
+            return -1;
+        slot->dirty_begin = eng->dirty_begin;
+        slot->dirty_end   = eng->dirty_end;
+        return 0;
+    }
+
+    /* the result lives in engine scratch: copy it out, drop the raster */
+    const uint8_t* data;
+    size_t length;
+    int ret = stego_engine_decode(eng, &slot->img, &data, &length);
+    image_free(&slot->img);
+    if (ret != 0)
+        return -1;
+    slot->msg.data = (uint8_t*)malloc(length ? length : 1);
+    if (!slot->msg.data)
+        return -1;
+    memcpy(slot->msg.data, data, length);
+    slot->msg.length = length;
+    return 0;
+}
+
+static int pipe_save(const BatchConfig* cfg, const BatchJob* job,
+                     PipeSlot* slot)
+{
+    if (cfg->op == BATCH_DECODE)
+        return stego_message_save(job->output, &slot->msg);
+    return image_save_ppm_patch(job->output, job->input, &slot->img,
+                                slot->dirty_begin, slot->dirty_end, 1);
+}
+
+static void run_pipeline(const BatchList* list, const BatchConfig* cfg,
+                         const StegoMessage* shared, BatchStats* stats)
+{
+    int n_load = cfg->pipe_load;
+    int n_save = cfg->pipe_save > 0 ? cfg->pipe_save : 1;
+    int n_work = cfg->pipe_work > 0 ? cfg->pipe_work : omp_get_max_threads();
+
+    PipeSlot* slots = (PipeSlot*)calloc((size_t)list->count + 1,
+                                        sizeof(PipeSlot));
+    if (!slots)
+        return;
+
+    PipeQueue loaded, worked;
+    queue_init(&loaded, n_load);
+    queue_init(&worked, 1);
+    int    next = 0;
+    double busy[3] = { 0.0, 0.0, 0.0 };
+
+    /* the engine team is nested inside the stage threads; each stage
+     * thread caps its own nested regions (raster reads, first touch,
+     * PNG/QOI coding) at its share of the budget */
+    int saved_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+    double t0 = get_time();
+
+    #pragma omp parallel num_threads(n_load + 1 + n_save)
+    {
+        int    tid = omp_get_thread_num();
+        double mine = 0.0, t;
+
+        if (tid < n_load) {
+            omp_set_num_threads(1);
+            for (;;) {
+                int i;
+                #pragma omp atomic capture
+                i = next++;
+                if (i >= list->count)
+                    break;
+                t = get_time();
+                int ok = pipe_load(cfg, &list->jobs[i], &slots[i]) == 0;
+                mine += get_time() - t;
+                if (ok)
+                    queue_push(&loaded, i);
+                else
+                    pipe_failed(&list->jobs[i]);
+            }
+            queue_close(&loaded);
+            #pragma omp atomic
+            busy[BATCH_STAGE_LOAD] += mine;
+        } else if (tid == n_load) {
+            omp_set_num_threads(n_work);
+            StegoEngine eng;
+            int have_eng = open_engine(&eng, cfg, n_work, cfg->model) == 0;
+            int i;
+            while (queue_pop(&loaded, &i)) {
+                t = get_time();
+                int ok = have_eng && pipe_work(&eng, cfg, &list->jobs[i],
+                                               shared, &slots[i]) == 0;
+                mine += get_time() - t;
+                if (ok) {
+                    queue_push(&worked, i);
+                } else {
+                    slot_free(&slots[i]);
+                    pipe_failed(&list->jobs[i]);
+                }
+            }
+            if (have_eng)
+                stego_engine_destroy(&eng);
+            queue_close(&worked);
+            busy[BATCH_STAGE_WORK] = mine;
+        } else {
+            omp_set_num_threads(1);
+            int i;
+            while (queue_pop(&worked, &i)) {
+                t = get_time();
+                int ok = pipe_save(cfg, &list->jobs[i], &slots[i]) == 0;
+                slot_free(&slots[i]);
+                mine += get_time() - t;
+                if (!ok)
+                    pipe_failed(&list->jobs[i]);
+                account(stats, ok, slots[i].bytes);
+            }
+            #pragma omp atomic
+            busy[BATCH_STAGE_SAVE] += mine;
+        }
+    }
+
+    double wall = get_time() - t0;
+    omp_set_max_active_levels(saved_levels);
+    omp_destroy_lock(&loaded.lock);
+    omp_destroy_lock(&worked.lock);
+    free(slots);
+
+    int threads[3] = { n_load, 1, n_save };
+    for (int s = 0; s < 3; s++) {
+        stats->stage_threads[s] = s == BATCH_STAGE_WORK ? n_work : threads[s];
+        stats->stage_util[s]    = wall > 0.0 ? busy[s] / (threads[s] * wall)
+                                             : 0.0;
+    }
+}
+
+int batch_run(const BatchList* list, const BatchConfig* cfg,
+              BatchStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    int workers = cfg->workers > 0 ? cfg->workers : omp_get_max_threads();
+
+    /* resolve the CPU kernels here, before workers open engines at once */
+    (void)stego_kernels();
+
+    StegoMessage shared = { NULL, 0 };
+    if (cfg->op == BATCH_ENCODE) {
+        for (int i = 0; i < list->count && !cfg->message; i++)
+            if (!list->jobs[i].message) {
+                fprintf(stderr, "[batch] '%s' has no message "
+                                "(use --message)\n", list->jobs[i].input);
+                return -1;
+            }
+        if (cfg->message && stego_message_load(cfg->message, &shared) != 0)
+            return -1;
+    }
+
+    /* Split: large images first (whole team per image), then the pool */
+    int* large = (int*)malloc((size_t)(list->count + 1) * sizeof(int));
+    int* small = (int*)malloc((size_t)(list->count + 1) * sizeof(int));
+    WorkRange* ranges = (WorkRange*)calloc((size_t)workers, sizeof(WorkRange));
+    if (!large || !small || !ranges) {
+        free(large); free(small); free(ranges);
+        stego_message_free(&shared);
+        return -1;
+    }
+    int n_large = 0, n_small = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (list->jobs[i].input_size >= BATCH_LARGE_BYTES)
+            large[n_large++] = i;
+        else
+            small[n_small++] = i;
+    }
+
+    /* Decoded (non-mapped) rasters are recycled between jobs */
+    size_t saved_pool = pixel_pool_limit();
+    if (saved_pool == 0)
+        pixel_pool_set_limit(PIXEL_POOL_DEFAULT_LIMIT);
+
+    double t0 = get_time();
+
+    if (cfg->pipe_load > 0) {
+        run_pipeline(list, cfg, &shared, stats);
+        n_large = n_small = 0;          /* every job went through it */
+    }
+
+    if (n_large > 0) {
+        StegoEngine eng;
+        if (open_engine(&eng, cfg, workers, cfg->model) == 0) {
+            for (int i = 0; i < n_large; i++) {
+                size_t bytes = 0;
+                int ok = run_job(&eng, cfg, &list->jobs[large[i]], &shared,
+                                 &bytes) == 0;
+                account(stats, ok, bytes);
+            }
+            stego_engine_destroy(&eng);
+        }
+    }
+
+    if (n_small > 0) {
+        int pool = workers < n_small ? workers : n_small;
+        for (int w = 0; w < pool; w++) {
+            omp_init_lock(&ranges[w].lock);
+            ranges[w].head = (int)((long)n_small * w / pool);
+            ranges[w].tail = (int)((long)n_small * (w + 1) / pool);
+        }
+
+        #pragma omp parallel num_threads(pool)
+        {
+            int self = omp_get_thread_num();
+            StegoEngine eng;
+            if (open_engine(&eng, cfg, 1, NULL) == 0) {
+                int slot;
+                while (next_job(ranges, pool, self, &slot)) {
+                    size_t bytes = 0;
+                    int ok = run_job(&eng, cfg, &list->jobs[small[slot]],
+                                     &shared, &bytes) == 0;
+                    account(stats, ok, bytes);
+                }
+                stego_engine_destroy(&eng);
+            }
+        }
+
+        for (int w = 0; w < pool; w++)
+            omp_destroy_lock(&ranges[w].lock);
+    }
+
+    stats->seconds = get_time() - t0;
+    stats->failed  = list->count - stats->done;
+    pixel_pool_set_limit(saved_pool);
+
+    free(large);
+    free(small);
+    free(ranges);
+    stego_message_free(&shared);
+    return stats->failed == 0 ? 0 : -1;
+}
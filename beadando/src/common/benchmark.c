@@ -5,6 +5,7 @@
 #include "opencl/run_cl.h"
 #include "opencl/stego_opencl.h"
 #include "openmp/stego_openmp.h"
+#include "openmp/stego_kernels.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,20 +41,22 @@ static StegoMessage make_test_message(size_t len)
 
 typedef enum { OP_ENCODE, OP_DECODE } Op;
 
-static double time_omp(Op op, const Image* carrier,
+/*
+ * `work` is a copy of the carrier that encode trials write into.  Every
+ * trial stores the same message into the same bytes, so it needs no
+ * reset between trials.
+ */
+static double time_omp(Op op, Image* work,
                         const StegoMessage* msg,
                         const Image* stego,
-                        int p)
+                        int bits, int p)
 {
     double start, end;
 
     if (op == OP_ENCODE) {
-        Image tmp;
-        image_copy(&tmp, carrier);
         start = get_time();
-        stego_encode_omp(&tmp, msg, p);
+        stego_encode_omp(work, msg, bits, p);
         end = get_time();
-        image_free(&tmp);
     } else {
         StegoMessage out = {NULL, 0};
         start = get_time();
@@ -65,19 +68,17 @@ static double time_omp(Op op, const Image* carrier,
 }
 
 static double time_ocl(Op op, CLContext* ctx,
-                        const Image* carrier,
+                        Image* work,
                         const StegoMessage* msg,
-                        const Image* stego)
+                        const Image* stego,
+                        int bits)
 {
     double start, end;
 
     if (op == OP_ENCODE) {
-        Image tmp;
-        image_copy(&tmp, carrier);
         start = get_time();
-        stego_encode_ocl(ctx, &tmp, msg);
+        stego_encode_ocl(ctx, work, msg, bits);
         end = get_time();
-        image_free(&tmp);
     } else {
         StegoMessage out = {NULL, 0};
         start = get_time();
@@ -90,42 +91,198 @@ static double time_ocl(Op op, CLContext* ctx,
 
 static double avg_time_omp(Op op, const Image* carrier,
                             const StegoMessage* msg, const Image* stego,
-                            int p, int trials)
+                            int bits, int p, int trials)
 {
+    Image work = { NULL, 0, 0, 0 };
+    if (op == OP_ENCODE && image_copy(&work, carrier) != 0)
+        return -1.0;
+
     double sum = 0.0;
     for (int t = 0; t < trials; t++)
-        sum += time_omp(op, carrier, msg, stego, p);
+        sum += time_omp(op, &work, msg, stego, bits, p);
+    image_free(&work);
     return sum / trials;
 }
 
 static double avg_time_ocl(Op op, CLContext* ctx,
                             const Image* carrier,
                             const StegoMessage* msg, const Image* stego,
-                            int trials)
+                            int bits, int trials)
 {
+    Image work = { NULL, 0, 0, 0 };
+    if (op == OP_ENCODE && image_copy(&work, carrier) != 0)
+        return -1.0;
+
+    /* Every trial reuses one carrier, like several messages on one image:
+     * keep it resident so trials move only the payload and the result. */
+    const Image* resident = op == OP_ENCODE ? &work : stego;
+    int pinned = stego_ocl_pin_image(ctx, resident) == 0;
+
     double sum = 0.0;
     for (int t = 0; t < trials; t++)
-        sum += time_ocl(op, ctx, carrier, msg, stego);
+        sum += time_ocl(op, ctx, &work, msg, stego, bits);
+    if (pinned)
+        stego_ocl_unpin_image(ctx, resident);
+    image_free(&work);
     return sum / trials;
 }
 
+/*
+ * Compare 4 KiB and huge-page backed carriers: time image_copy (alloc +
+ * first touch) and an OMP encode on the fresh copy under each setting.
+ * The buffer pool is off here, or every copy after the first would be
+ * a recycled, already-faulted buffer.
+ */
+static void bench_page_backing(long n, const Image* carrier,
+                               const StegoMessage* msg, int bits, int trials)
+{
+    double t_copy[2] = {0.0, 0.0}, t_enc[2] = {0.0, 0.0};
+    int    saved      = pixel_huge_pages();
+    size_t saved_pool = pixel_pool_limit();
+    pixel_pool_set_limit(0);
+
+    for (int huge = 0; huge < 2; huge++) {
+        pixel_set_huge_pages(huge);
+        for (int t = 0; t < trials; t++) {
+            Image tmp;
+            double t0 = get_time();
+            if (image_copy(&tmp, carrier) != 0) continue;
+            double t1 = get_time();
+            stego_encode_omp(&tmp, msg, bits, 0);
+            double t2 = get_time();
+            image_free(&tmp);
+            t_copy[huge] += t1 - t0;
+            t_enc[huge]  += t2 - t1;
+        }
+    }
+    pixel_set_huge_pages(saved);
+    pixel_pool_set_limit(saved_pool);
+
+    printf("[bench] n=%ld pages | 4K: copy=%.4fs enc=%.4fs | "
+           "2M: copy=%.4fs enc=%.4fs\n",
+           n, t_copy[0] / trials, t_enc[0] / trials,
+           t_copy[1] / trials, t_enc[1] / trials);
+}
+
+/*
+ * Sequential vs keyed scatter order: OMP encode and decode with the
+ * default team on the same carrier and message.
+ */
+static void bench_scatter(long n, const Image* carrier,
+                          const StegoMessage* msg, int bits, int trials)
+{
+    StegoKey key;
+    stego_key_derive(&key, "bench");
+    StegoSegment body = { msg->data, msg->length };
+
+    double t_enc[2] = {0.0, 0.0}, t_dec[2] = {0.0, 0.0};
+    uint8_t* buf = NULL;
+    size_t   cap = 0, len;
+
+    for (int keyed = 0; keyed < 2; keyed++) {
+        const StegoKey* k = keyed ? &key : NULL;
+        Image tmp;
+        if (image_copy(&tmp, carrier) != 0) continue;
+        for (int t = 0; t < trials; t++) {
+            double t0 = get_time();
+            stego_encode_omp_keyed(&tmp, &body, 1, bits, k, 0);
+            double t1 = get_time();
+            stego_decode_omp_keyed_into(&tmp, k, &buf, &cap, &len, 0);
+            double t2 = get_time();
+            t_enc[keyed] += t1 - t0;
+            t_dec[keyed] += t2 - t1;
+        }
+        image_free(&tmp);
+    }
+    free(buf);
+
+    printf("[bench] n=%ld order | seq: enc=%.4fs dec=%.4fs | "
+           "keyed: enc=%.4fs dec=%.4fs\n",
+           n, t_enc[0] / trials, t_dec[0] / trials,
+           t_enc[1] / trials, t_dec[1] / trials);
+}
+
+/*
+ * Carrier I/O per format: save and load the carrier through image_save /
+ * image_load and report raster throughput plus the file size.
+ */
+static void bench_formats(long n, const Image* carrier, int trials)
+{
+    static const char* exts[] = { "ppm", "png", "qoi" };
+    double raster = (double)carrier->width * carrier->height * carrier->channels;
+
+    printf("[bench] n=%ld io", n);
+    for (int e = 0; e < 3; e++) {
+        char path[256];
+        snprintf(path, sizeof(path), "data/samples/bench_io.%s", exts[e]);
+
+        double t_save = 0.0, t_load = 0.0;
+        int ok = 1;
+        for (int t = 0; t < trials && ok; t++) {
+            Image tmp;
+            double t0 = get_time();
+            ok = image_save(path, carrier) == 0;
+            double t1 = get_time();
+            ok = ok && image_load(path, &tmp) == 0;
+            double t2 = get_time();
+            if (ok) image_free(&tmp);
+            t_save += t1 - t0;
+            t_load += t2 - t1;
+        }
+
+        FILE* f = fopen(path, "rb");
+        long size = -1;
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            size = ftell(f);
+            fclose(f);
+        }
+        remove(path);
+
+        if (!ok) {
+            printf(" | %s: failed", exts[e]);
+            continue;
+        }
+        printf(" | %s: save=%.1f MB/s load=%.1f MB/s size=%.2f MB",
+               exts[e], raster * trials / t_save / 1e6,
+               raster * trials / t_load / 1e6, size / 1e6);
+    }
+    printf("\n");
+}
+
 int run_benchmark(const BenchmarkConfig* cfg)
 {
+    if (stego_kernels_select(cfg->isa) != 0) {
+        fprintf(stderr, "[bench] Selected ISA is not supported on this CPU\n");
+        return -1;
+    }
+    const char* isa_name = stego_kernels()->name;
+    pixel_set_numa_policy(cfg->numa);
+    pixel_set_huge_pages(cfg->huge_pages);
+    printf("[bench] OMP kernels: %s, k=%d\n", isa_name, cfg->bits);
+
     FILE* f = fopen(cfg->csv_path, "w");
     if (!f) {
         fprintf(stderr, "[bench] Cannot open '%s' for writing\n", cfg->csv_path);
         return -1;
     }
 
+    /* Trial copies come from the pool: no per-trial malloc or page faults */
+    size_t saved_pool = pixel_pool_limit();
+    if (saved_pool == 0)
+        pixel_pool_set_limit(PIXEL_POOL_DEFAULT_LIMIT);
+
     fprintf(f,
         "n,p,"
         "omp_encode,ocl_encode,"
         "omp_decode,ocl_decode,"
         "S_omp_encode,E_omp_encode,S_ocl_encode,"
-        "S_omp_decode,E_omp_decode,S_ocl_decode\n");
+        "S_omp_decode,E_omp_decode,S_ocl_decode,"
+        "isa,bits\n");
 
     CLContext cl_ctx;
-    if (cl_init(&cl_ctx) != 0) {
+    int ocl_ok = cl_init(&cl_ctx) == 0;
+    if (!ocl_ok) {
         fprintf(stderr, "[bench] OpenCL init failed – OCL columns will be -1\n");
     }
 
@@ -144,35 +301,39 @@ int run_benchmark(const BenchmarkConfig* cfg)
             continue;
         }
 
-        size_t cap = stego_capacity_bytes(&carrier);
+        /* the stego copy and one work copy, pre-faulted */
+        pixel_pool_reserve((size_t)side * side * 3, 2);
+
+        size_t cap = stego_capacity_bytes(&carrier, cfg->bits);
         size_t msg_len = cap * 3 / 4;
         if (msg_len > 4u * 1024 * 1024) msg_len = 4u * 1024 * 1024;
         StegoMessage msg = make_test_message(msg_len);
 
         Image stego;
         image_copy(&stego, &carrier);
-        stego_encode_omp(&stego, &msg, 1);
+        stego_encode_omp(&stego, &msg, cfg->bits, 1);
 
-        {
+        double t_ocl_enc = -1.0, t_ocl_dec = -1.0;
+        if (ocl_ok) {
             Image tmp; image_copy(&tmp, &carrier);
-            stego_encode_ocl(&cl_ctx, &tmp, &msg);
+            stego_encode_ocl(&cl_ctx, &tmp, &msg, cfg->bits);
             image_free(&tmp);
             StegoMessage out = {NULL,0};
             stego_decode_ocl(&cl_ctx, &stego, &out);
             stego_message_free(&out);
-        }
 
-        double t_ocl_enc = avg_time_ocl(OP_ENCODE, &cl_ctx,
-                                         &carrier, &msg, &stego,
-                                         cfg->trials);
-        double t_ocl_dec = avg_time_ocl(OP_DECODE, &cl_ctx,
-                                         &carrier, &msg, &stego,
-                                         cfg->trials);
+            t_ocl_enc = avg_time_ocl(OP_ENCODE, &cl_ctx,
+                                     &carrier, &msg, &stego,
+                                     cfg->bits, cfg->trials);
+            t_ocl_dec = avg_time_ocl(OP_DECODE, &cl_ctx,
+                                     &carrier, &msg, &stego,
+                                     cfg->bits, cfg->trials);
+        }
 
         double t_omp_enc_p1 = avg_time_omp(OP_ENCODE, &carrier, &msg,
-                                            &stego, 1, cfg->trials);
+                                            &stego, cfg->bits, 1, cfg->trials);
         double t_omp_dec_p1 = avg_time_omp(OP_DECODE, &carrier, &msg,
-                                            &stego, 1, cfg->trials);
+                                            &stego, cfg->bits, 1, cfg->trials);
 
         double S_ocl_enc = (t_ocl_enc > 0.0) ? t_omp_enc_p1 / t_ocl_enc : 0.0;
         double S_ocl_dec = (t_ocl_dec > 0.0) ? t_omp_dec_p1 / t_ocl_dec : 0.0;
@@ -186,9 +347,9 @@ int run_benchmark(const BenchmarkConfig* cfg)
                 t_omp_dec = t_omp_dec_p1;
             } else {
                 t_omp_enc = avg_time_omp(OP_ENCODE, &carrier, &msg,
-                                          &stego, p, cfg->trials);
+                                          &stego, cfg->bits, p, cfg->trials);
                 t_omp_dec = avg_time_omp(OP_DECODE, &carrier, &msg,
-                                          &stego, p, cfg->trials);
+                                          &stego, cfg->bits, p, cfg->trials);
             }
 
             double S_omp_enc = (t_omp_enc > 0.0) ? t_omp_enc_p1 / t_omp_enc : 0.0;
@@ -201,27 +362,40 @@ int run_benchmark(const BenchmarkConfig* cfg)
                 "%.6f,%.6f,"
                 "%.6f,%.6f,"
                 "%.4f,%.4f,%.4f,"
-                "%.4f,%.4f,%.4f\n",
+                "%.4f,%.4f,%.4f,"
+                "%s,%d\n",
                 n, p,
                 t_omp_enc, t_ocl_enc,
                 t_omp_dec, t_ocl_dec,
                 S_omp_enc, E_omp_enc, S_ocl_enc,
-                S_omp_dec, E_omp_dec, S_ocl_dec);
+                S_omp_dec, E_omp_dec, S_ocl_dec,
+                isa_name, cfg->bits);
 
             printf("[bench] n=%ld p=%d | enc: OMP=%.4fs OCL=%.4fs | "
                    "dec: OMP=%.4fs OCL=%.4fs\n",
                    n, p, t_omp_enc, t_ocl_enc, t_omp_dec, t_ocl_dec);
         }
 
+        bench_page_backing(n, &carrier, &msg, cfg->bits, cfg->trials);
+        bench_scatter(n, &carrier, &msg, cfg->bits, cfg->trials);
+        bench_formats(n, &carrier, cfg->trials);
+
         stego_message_free(&msg);
         image_free(&carrier);
         image_free(&stego);
     }
 
     fclose(f);
+
+    PixelPoolStats pool;
+    pixel_pool_stats(&pool);
+    printf("[bench] Buffer pool: %zu reused, %zu allocated\n",
+           pool.hits, pool.misses);
+    pixel_pool_set_limit(saved_pool);
     printf("[bench] Results saved to: %s\n", cfg->csv_path);
 
-    cl_cleanup(&cl_ctx);
+    if (ocl_ok)
+        cl_cleanup(&cl_ctx);
 
     if (cfg->plot_enabled) {
         typedef struct { const char* op; int col_omp; int col_S_omp; } PlotEntry;
@@ -264,6 +438,10 @@ int benchmark_handle_args(int argc, char* argv[], BenchmarkConfig* cfg)
     cfg->n_count      = 0;
     cfg->p_count      = 0;
     cfg->trials       = 3;
+    cfg->isa          = stego_isa_detect();
+    cfg->bits         = 1;
+    cfg->numa         = pixel_numa_policy();
+    cfg->huge_pages   = pixel_huge_pages();
     snprintf(cfg->csv_path, sizeof(cfg->csv_path),
              "data/results/performance.csv");
 
@@ -278,6 +456,25 @@ int benchmark_handle_args(int argc, char* argv[], BenchmarkConfig* cfg)
             cfg->p_values[cfg->p_count++] = atoi(argv[i] + 2);
         } else if (strncmp(argv[i], "t=", 2) == 0) {
             cfg->trials = atoi(argv[i] + 2);
+        } else if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc) {
+            cfg->bits = atoi(argv[++i]);
+            if (cfg->bits < STEGO_MIN_BITS || cfg->bits > STEGO_MAX_BITS) {
+                fprintf(stderr, "[bench] --bits must be %d..%d\n",
+                        STEGO_MIN_BITS, STEGO_MAX_BITS);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--numa") == 0 && i + 1 < argc) {
+            if (pixel_parse_numa_policy(argv[++i], &cfg->numa) != 0) {
+                fprintf(stderr, "[bench] Unknown NUMA policy '%s'\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--hugepages") == 0 && i + 1 < argc) {
+            cfg->huge_pages = strcmp(argv[++i], "off") != 0;
+        } else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc) {
+            if (stego_isa_parse(argv[++i], &cfg->isa) != 0) {
+                fprintf(stderr, "[bench] Unknown ISA '%s'\n", argv[i]);
+                return -1;
+            }
         } else {
             if (mode == N_MODE)
                 cfg->n_widths[cfg->n_count++] = atoi(argv[i]);
@@ -286,7 +483,9 @@ int benchmark_handle_args(int argc, char* argv[], BenchmarkConfig* cfg)
             else {
                 fprintf(stderr,
                         "[bench] Unknown argument '%s'. "
-                        "Usage: n=<v>... p=<v>... t=<trials> -noplot\n",
+                        "Usage: n=<v>... p=<v>... t=<trials> -noplot "
+                        "--isa <name> --bits <k> "
+                        "--numa <policy> --hugepages on|off\n",
                         argv[i]);
                 return -1;
             }
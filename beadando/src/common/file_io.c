@@ -0,0 +1,358 @@
+#if !defined(_WIN32)
+#  define _GNU_SOURCE
+#endif
+
+#include "common/file_io.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
+#if defined(STEGO_IO_URING) && defined(__linux__)
+#  include <linux/io_uring.h>
+#  include <pthread.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  define HAVE_URING 1
+#else
+#  define HAVE_URING 0
+#endif
+
+/* ======================================================================
+ * pread / pwrite fallback
+ * ====================================================================== */
+
+static int plain_transfer(int fd, uint8_t* buf, size_t len, uint64_t offset,
+                          int write)
+{
+    while (len > 0) {
+        size_t n = len < ((size_t)1 << 30) ? len : (size_t)1 << 30;
+#if defined(_WIN32)
+        long got = -1;
+        if (_lseeki64(fd, (__int64)offset, SEEK_SET) >= 0)
+            got = write ? _write(fd, buf, (unsigned)n)
+                        : _read(fd, buf, (unsigned)n);
+#else
+        ssize_t got = write ? pwrite(fd, buf, n, (off_t)offset)
+                            : pread(fd, buf, n, (off_t)offset);
+        if (got < 0 && errno == EINTR)
+            continue;
+#endif
+        if (got <= 0)
+            return -1;
+        buf    += got;
+        offset += (uint64_t)got;
+        len    -= (size_t)got;
+    }
+    return 0;
+}
+
+#if HAVE_URING
+/* ======================================================================
+ * io_uring backend (raw syscalls; no liburing dependency)
+ * ====================================================================== */
+
+typedef struct {
+    int                  fd;
+    unsigned*            sq_head;
+    unsigned*            sq_tail;
+    unsigned*            sq_mask;
+    unsigned*            sq_array;
+    unsigned*            cq_head;
+    unsigned*            cq_tail;
+    unsigned*            cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void*                sq_map;        /* mappings, for teardown */
+    void*                cq_map;
+    size_t               sq_len;
+    size_t               cq_len;
+    size_t               sqes_len;
+} Ring;
+
+typedef struct {
+    uint8_t* buf;
+    size_t   len;               /* bytes still to move; 0 = slot free */
+    uint64_t offset;
+    int      pending;           /* needs (re)submission */
+} Span;
+
+static _Thread_local Ring ring;
+static _Thread_local int  ring_state;       /* 0 untried, 1 up, -1 down */
+static int uring_off;                       /* kernel said no: all threads */
+static int uring_used;
+static pthread_key_t  ring_key;             /* runs ring_close at thread exit */
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static int ring_setup(Ring* r)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, FILE_IO_DEPTH, &p);
+    if (fd < 0)
+        return -1;
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int    single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cq_len > sq_len)
+        sq_len = cq_len;
+
+    uint8_t* sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    uint8_t* cq = sq;
+    if (sq != MAP_FAILED && !single)
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void* sqes = MAP_FAILED;
+    if (sq != MAP_FAILED && cq != MAP_FAILED)
+        sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cq != MAP_FAILED && cq != sq) munmap(cq, cq_len);
+        if (sq != MAP_FAILED) munmap(sq, sq_len);
+        close(fd);
+        return -1;
+    }
+
+    r->fd       = fd;
+    r->sq_head  = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->cq_head  = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->sqes     = (struct io_uring_sqe*)sqes;
+    r->cqes     = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    r->sq_map   = sq;
+    r->cq_map   = cq;
+    r->sq_len   = sq_len;
+    r->cq_len   = cq_len;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    return 0;
+}
+
+/* Unmap and close; closing the fd cancels anything the kernel still has */
+static void ring_close(void* arg)
+{
+    Ring* r = (Ring*)arg;
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_len);
+    munmap(r->sq_map, r->sq_len);
+    close(r->fd);
+}
+
+static void ring_key_init(void)
+{
+    pthread_key_create(&ring_key, ring_close);
+}
+
+/* Retire this thread's ring after an error; it stays on pread/pwrite */
+static void ring_retire(Ring* r)
+{
+    pthread_setspecific(ring_key, NULL);
+    ring_close(r);
+    ring_state = -1;
+}
+
+/* This thread's ring, set up on first use; NULL = use pread/pwrite */
+static Ring* thread_ring(void)
+{
+    int off;
+    #pragma omp atomic read
+    off = uring_off;
+    if (off || ring_state < 0)
+        return NULL;
+    if (ring_state == 0) {
+        if (ring_setup(&ring) != 0) {
+            ring_state = -1;
+            #pragma omp atomic write
+            uring_off = 1;
+            return NULL;
+        }
+        ring_state = 1;
+        pthread_once(&ring_once, ring_key_init);
+        pthread_setspecific(ring_key, &ring);
+        #pragma omp atomic write
+        uring_used = 1;
+    }
+    return &ring;
+}
+
+static void queue_span(Ring* r, const Span* s, int slot, int fd, int write)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned idx  = tail & *r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)s->buf;
+    sqe->len       = (unsigned)s->len;
+    sqe->off       = s->offset;
+    sqe->user_data = (uint64_t)slot;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Drop every posted completion; returns how many there were */
+static unsigned reap(Ring* r)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    __atomic_store_n(r->cq_head, tail, __ATOMIC_RELEASE);
+    return tail - head;
+}
+
+/*
+ * Keep up to FILE_IO_DEPTH chunks in flight until the range is moved.
+ * Short transfers are resubmitted for the rest of their chunk.
+ * Returns 0 on success, -1 on I/O error, 1 if the kernel lacks the
+ * opcodes (nothing usable was transferred; caller falls back).
+ */
+static int uring_transfer(Ring* r, int fd, uint8_t* buf, size_t len,
+                          uint64_t offset, int write)
+{
+    Span   span[FILE_IO_DEPTH];
+    size_t next     = 0;
+    int    inflight = 0, failed = 0, unsupported = 0;
+    memset(span, 0, sizeof(span));
+
+    for (;;) {
+        for (int s = 0; s < FILE_IO_DEPTH && !failed; s++) {
+            if (span[s].len == 0 && next < len) {
+                size_t n = len - next < FILE_IO_CHUNK ? len - next
+                                                      : FILE_IO_CHUNK;
+                span[s].buf     = buf + next;
+                span[s].len     = n;
+                span[s].offset  = offset + next;
+                span[s].pending = 1;
+                next += n;
+            }
+            if (span[s].pending) {
+                queue_span(r, &span[s], s, fd, write);
+                span[s].pending = 0;
+                inflight++;
+            }
+        }
+        if (inflight == 0)
+            break;
+
+        /* entries the kernel has not consumed yet (also after EINTR) */
+        unsigned submit = *r->sq_tail
+                        - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        long ret = syscall(__NR_io_uring_enter, r->fd, submit, 1u,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            /*
+             * The ring is in an unknown state, but requests the kernel
+             * took may still be moving data into buf: wait them out
+             * before the caller reuses it, then retire the ring.
+             */
+            inflight -= (int)(*r->sq_tail
+                              - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+            while (inflight > 0) {
+                inflight -= (int)reap(r);
+                if (inflight > 0
+                    && syscall(__NR_io_uring_enter, r->fd, 0u, 1u,
+                               IORING_ENTER_GETEVENTS, NULL, 0) < 0
+                    && errno != EINTR)
+                    break;              /* ring_close cancels the rest */
+            }
+            ring_retire(r);
+            return -1;
+        }
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+            Span* s = &span[cqe->user_data];
+            int   res = cqe->res;
+            inflight--;
+            if (res == -EINTR || res == -EAGAIN) {
+                s->pending = !failed;
+                if (failed) s->len = 0;
+            } else if (res <= 0) {
+                if (res == -EINVAL || res == -EOPNOTSUPP)
+                    unsupported = 1;
+                failed = 1;
+                s->len = 0;
+            } else {
+                s->buf    += res;
+                s->offset += (uint64_t)res;
+                s->len    -= (size_t)res;
+                s->pending = s->len > 0 && !failed;
+                if (failed) s->len = 0;
+            }
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (unsupported) {
+        #pragma omp atomic write
+        uring_off = 1;
+        return 1;
+    }
+    return failed ? -1 : 0;
+}
+#endif /* HAVE_URING */
+
+static int transfer(int fd, uint8_t* buf, size_t len, uint64_t offset,
+                    int write)
+{
+#if HAVE_URING
+    Ring* r = len > FILE_IO_CHUNK ? thread_ring() : NULL;
+    if (r) {
+        int ret = uring_transfer(r, fd, buf, len, offset, write);
+        if (ret <= 0)
+            return ret;
+    }
+#endif
+    return plain_transfer(fd, buf, len, offset, write);
+}
+
+int file_read_at(int fd, void* buf, size_t len, uint64_t offset)
+{
+    return transfer(fd, (uint8_t*)buf, len, offset, 0);
+}
+
+int file_write_at(int fd, const void* buf, size_t len, uint64_t offset)
+{
+    return transfer(fd, (uint8_t*)(uintptr_t)buf, len, offset, 1);
+}
+
+int file_io_async(void)
+{
+#if HAVE_URING
+    int off;
+    #pragma omp atomic read
+    off = uring_off;
+    return !off;
+#else
+    return 0;
+#endif
+}
+
+const char* file_io_backend(void)
+{
+#if HAVE_URING
+    int used, off;
+    #pragma omp atomic read
+    used = uring_used;
+    #pragma omp atomic read
+    off = uring_off;
+    if (used && !off)
+        return "io_uring";
+#endif
+    return "pread";
+}
@@ -1,11 +1,14 @@
 #include "common/filesystem_utils.h"
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 #ifdef _WIN32
 #include <direct.h>
+#include <windows.h>
 #define MKDIR(p) _mkdir(p)
 #else
+#include <dirent.h>
 #include <sys/stat.h>
 #define MKDIR(p) mkdir(p, 0755)
 #endif
@@ -41,4 +44,78 @@ int create_output_directories(const char* file_path)
 
     free(tmp);
     return 0;
-}
\ No newline at end of file
+}
+
+static int append_name(char*** names, int* count, int* cap, const char* name)
+{
+    if (*count == *cap) {
+        int grown_cap = *cap ? *cap * 2 : 64;
+        char** grown = (char**)realloc(*names, (size_t)grown_cap * sizeof(char*));
+        if (!grown) return -1;
+        *names = grown;
+        *cap   = grown_cap;
+    }
+    char* copy = (char*)malloc(strlen(name) + 1);
+    if (!copy) return -1;
+    strcpy(copy, name);
+    (*names)[(*count)++] = copy;
+    return 0;
+}
+
+static int compare_names(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int list_directory_files(const char* dir, char*** names, int* count)
+{
+    int cap = 0;
+    *names = NULL;
+    *count = 0;
+
+#ifdef _WIN32
+    char pattern[1024];
+    WIN32_FIND_DATAA fd;
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) return -1;
+    do {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        if (append_name(names, count, &cap, fd.cFileName) != 0) {
+            FindClose(h);
+            free_directory_listing(*names, *count);
+            *names = NULL;
+            return -1;
+        }
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR* d = opendir(dir);
+    if (!d) return -1;
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL) {
+        char path[4096];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (append_name(names, count, &cap, e->d_name) != 0) {
+            closedir(d);
+            free_directory_listing(*names, *count);
+            *names = NULL;
+            return -1;
+        }
+    }
+    closedir(d);
+#endif
+
+    if (*count > 1)
+        qsort(*names, (size_t)*count, sizeof(char*), compare_names);
+    return 0;
+}
+
+void free_directory_listing(char** names, int count)
+{
+    for (int i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+}
@@ -1,12 +1,37 @@
+#if !defined(_WIN32)
+#  define _GNU_SOURCE
+#endif
+
 #include "common/image_io.h"
+#include "common/file_io.h"
 #include "common/filesystem_utils.h"
+#include "common/pixel_buffer.h"
+#include "common/png_read.h"
+#include "common/png_write.h"
+#include "common/qoi.h"
 #include "stb/stb_image.h"
 #include "stb/stb_image_write.h"
 
+#include <errno.h>
+#include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/ioctl.h>
+#  include <sys/stat.h>
+#endif
+
+#if defined(__linux__)
+#  include <sys/syscall.h>
+#  ifndef FICLONE
+#    define FICLONE _IOW(0x94, 9, int)
+#  endif
+#endif
+
 static void skip_ppm_comments(FILE* f)
 {
     int c;
@@ -18,19 +43,52 @@ static void skip_ppm_comments(FILE* f)
         ungetc(c, f);
 }
 
-int image_load_ppm(const char* path, Image* img)
+/*
+ * Read `size` raster bytes from the current position of f.  With a NUMA
+ * policy each thread pread()s its pixel_place_range() slice, the pages
+ * it will later process, so the reads double as the parallel first touch.  Otherwise, and
+ * always on io_uring builds, one file_read_at keeps the device queue full.
+ */
+static int read_raster(FILE* f, uint8_t* dst, size_t size)
+{
+#if !defined(_WIN32)
+    if (pixel_numa_policy() != NUMA_POLICY_NONE && !file_io_async()) {
+        int    fd     = fileno(f);
+        off_t  base   = (off_t)ftell(f);
+        int    failed = 0;
+
+        #pragma omp parallel reduction(|:failed)
+        {
+            size_t begin, end;
+            pixel_place_range(dst, size, omp_get_thread_num(),
+                              omp_get_num_threads(), &begin, &end);
+            while (begin < end) {
+                ssize_t got = pread(fd, dst + begin, end - begin,
+                                    base + (off_t)begin);
+                if (got <= 0) { failed = 1; break; }
+                begin += (size_t)got;
+            }
+        }
+        return failed ? -1 : 0;
+    }
+#endif
+    long base = ftell(f);
+    return base < 0 ? -1 : file_read_at(fileno(f), dst, size, (uint64_t)base);
+}
+
+FILE* image_open_ppm(const char* path, int* width, int* height)
 {
     FILE* f = fopen(path, "rb");
     if (!f) {
         fprintf(stderr, "[image_io] Cannot open '%s' for reading\n", path);
-        return -1;
+        return NULL;
     }
 
     char magic[3];
     if (fscanf(f, "%2s", magic) != 1 || strcmp(magic, "P6") != 0) {
         fprintf(stderr, "[image_io] '%s' is not a binary PPM (P6) file\n", path);
         fclose(f);
-        return -1;
+        return NULL;
     }
 
     skip_ppm_comments(f);
@@ -46,22 +104,40 @@ int image_load_ppm(const char* path, Image* img)
     if (w <= 0 || h <= 0 || maxval != 255) {
         fprintf(stderr, "[image_io] Unsupported PPM header in '%s'\n", path);
         fclose(f);
-        return -1;
+        return NULL;
     }
 
+    *width  = w;
+    *height = h;
+    return f;
+
+bad_header:
+    fprintf(stderr, "[image_io] Malformed PPM header in '%s'\n", path);
+    fclose(f);
+    return NULL;
+}
+
+int image_load_ppm(const char* path, Image* img)
+{
+    int w, h;
+    FILE* f = image_open_ppm(path, &w, &h);
+    if (!f)
+        return -1;
+
     img->width    = w;
     img->height   = h;
     img->channels = 3;
-    img->pixels   = (uint8_t*)malloc((size_t)w * h * 3);
+    size_t size   = (size_t)w * h * 3;
+    img->pixels   = pixel_alloc(size);
     if (!img->pixels) {
         fprintf(stderr, "[image_io] Out of memory\n");
         fclose(f);
         return -1;
     }
 
-    if (fread(img->pixels, 1, (size_t)w * h * 3, f) != (size_t)(w * h * 3)) {
+    if (read_raster(f, img->pixels, size) != 0) {
         fprintf(stderr, "[image_io] Truncated pixel data in '%s'\n", path);
-        free(img->pixels);
+        pixel_free(img->pixels, size);
         img->pixels = NULL;
         fclose(f);
         return -1;
@@ -69,11 +145,55 @@ int image_load_ppm(const char* path, Image* img)
 
     fclose(f);
     return 0;
+}
 
-bad_header:
-    fprintf(stderr, "[image_io] Malformed PPM header in '%s'\n", path);
+int image_map_ppm(const char* path, Image* img, ImageMapMode mode)
+{
+#if !defined(_WIN32)
+    int w, h;
+    FILE* f = image_open_ppm(path, &w, &h);
+    if (!f)
+        return -1;
+
+    size_t size   = (size_t)w * h * 3;
+    long   offset = ftell(f);
+    struct stat st;
+    if (offset < 0 || fstat(fileno(f), &st) != 0
+        || (uint64_t)st.st_size < (uint64_t)offset + size) {
+        /* A short file would SIGBUS on access instead of failing here */
+        fprintf(stderr, "[image_io] Truncated pixel data in '%s'\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    uint8_t* pixels = pixel_map_file(fileno(f), (uint64_t)offset, size,
+                                     mode == IMAGE_MAP_PRIVATE);
     fclose(f);
-    return -1;
+    if (pixels) {
+        img->pixels   = pixels;
+        img->width    = w;
+        img->height   = h;
+        img->channels = 3;
+        return 0;
+    }
+#else
+    (void)mode;
+#endif
+    /* No mmap: an ordinary load satisfies both modes */
+    return image_load_ppm(path, img);
+}
+
+static int is_ppm_path(const char* path)
+{
+    const char* ext = strrchr(path, '.');
+    return ext && (strcmp(ext, ".ppm") == 0 || strcmp(ext, ".PPM") == 0);
+}
+
+int image_map(const char* path, Image* img, ImageMapMode mode)
+{
+    if (is_ppm_path(path))
+        return image_map_ppm(path, img, mode);
+    return image_load(path, img);
 }
 
 int image_save_ppm(const char* path, const Image* img)
@@ -91,8 +211,11 @@ int image_save_ppm(const char* path, const Image* img)
 
     fprintf(f, "P6\n%d %d\n255\n", img->width, img->height);
 
-    size_t n = (size_t)img->width * img->height * img->channels;
-    if (fwrite(img->pixels, 1, n, f) != n) {
+    /* header through stdio, raster straight to the descriptor */
+    size_t n    = (size_t)img->width * img->height * img->channels;
+    long   base = fflush(f) == 0 ? ftell(f) : -1;
+    if (base < 0
+        || file_write_at(fileno(f), img->pixels, n, (uint64_t)base) != 0) {
         fprintf(stderr, "[image_io] Write error for '%s'\n", path);
         fclose(f);
         return -1;
@@ -102,8 +225,118 @@ int image_save_ppm(const char* path, const Image* img)
     return 0;
 }
 
+#if !defined(_WIN32)
+/*
+ * Make dst a byte copy of src: reflink (FICLONE) when the filesystem
+ * shares extents, else copy_file_range in the kernel, else pread/pwrite.
+ * Explicit offsets throughout: src has been read through stdio already.
+ */
+static int clone_file(int src, int dst, off_t size)
+{
+    off_t done = 0;
+#if defined(__linux__)
+    if (ioctl(dst, FICLONE, src) == 0)
+        return 0;
+#  if defined(SYS_copy_file_range)
+    while (done < size) {
+        loff_t in = done, out = done;
+        long   got = syscall(SYS_copy_file_range, src, &in, dst, &out,
+                             (size_t)(size - done), 0u);
+        if (got > 0) {
+            done += got;
+            continue;
+        }
+        if (got < 0 && errno == EINTR)
+            continue;
+        /* unsupported here: finish in userspace; anything else is real */
+        if (got < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+                        || errno == EOPNOTSUPP))
+            break;
+        return -1;
+    }
+#  endif
+#endif
+    char buf[1 << 16];
+    while (done < size) {
+        size_t  n   = size - done < (off_t)sizeof(buf) ? (size_t)(size - done)
+                                                        : sizeof(buf);
+        ssize_t got = pread(src, buf, n, done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0 || file_write_at(dst, buf, (size_t)got,
+                                      (uint64_t)done) != 0)
+            return -1;
+        done += got;
+    }
+    return 0;
+}
+#endif
+
+int image_save_ppm_patch(const char* path, const char* source,
+                         const Image* img, size_t begin, size_t end,
+                         int num_threads)
+{
+#if !defined(_WIN32)
+    if (!is_ppm_path(path) || !is_ppm_path(source))
+        return image_save_threads(path, img, num_threads);
+
+    int w, h;
+    FILE* f = image_open_ppm(source, &w, &h);
+    if (!f)
+        return image_save_threads(path, img, num_threads);
+
+    size_t size   = (size_t)w * h * 3;
+    long   offset = ftell(f);
+    struct stat src_st, dst_st;
+    if (w != img->width || h != img->height || img->channels != 3
+        || offset < 0 || fstat(fileno(f), &src_st) != 0
+        || (uint64_t)src_st.st_size < (uint64_t)offset + size
+        || begin > end || end > size) {
+        fclose(f);
+        return image_save_threads(path, img, num_threads);
+    }
+
+    if (create_output_directories(path) != 0) {
+        fprintf(stderr, "[image_io] Cannot create directory for '%s'\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    /* Same file (in-place encode): only the patch is written */
+    int same = stat(path, &dst_st) == 0 && dst_st.st_dev == src_st.st_dev
+            && dst_st.st_ino == src_st.st_ino;
+    int fd = open(path, same ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[image_io] Cannot open '%s' for writing\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    int ret = 0;
+    if (!same && clone_file(fileno(f), fd, src_st.st_size) != 0)
+        ret = -1;
+
+    if (ret == 0 && file_write_at(fd, img->pixels + begin, end - begin,
+                                  (uint64_t)offset + begin) != 0)
+        ret = -1;
+
+    if (close(fd) != 0)
+        ret = -1;
+    fclose(f);
+    if (ret != 0)
+        fprintf(stderr, "[image_io] Write error for '%s'\n", path);
+    return ret;
+#else
+    (void)source; (void)begin; (void)end;
+    return image_save_threads(path, img, num_threads);
+#endif
+}
+
 int image_load_png(const char* path, Image* img)
 {
+    if (png_read(path, img) == 0)
+        return 0;
+
     int w, h, n;
     unsigned char* stbi_data = stbi_load(path, &w, &h, &n, 3);
     if (!stbi_data) {
@@ -116,31 +349,29 @@ int image_load_png(const char* path, Image* img)
     img->height = h;
     img->channels = 3;
     size_t size = (size_t)w * h * 3;
-    img->pixels = (uint8_t*)malloc(size);
+    img->pixels = pixel_alloc(size);
     if (!img->pixels) {
         stbi_image_free(stbi_data);
         return -1;
     }
-    memcpy(img->pixels, stbi_data, size);
+    pixel_copy(img->pixels, stbi_data, size);
     stbi_image_free(stbi_data);
     return 0;
 }
 
-int image_save_png(const char* path, const Image* img)
+static int save_png(const char* path, const Image* img, int num_threads)
 {
     if (create_output_directories(path) != 0) {
         fprintf(stderr, "[image_io] Cannot create directory for '%s'\n", path);
         return -1;
     }
     
-    int stride = img->width * 3;
-    int ret = stbi_write_png(path, img->width, img->height, 3,
-                             img->pixels, stride);
-    if (ret == 0) {
-        fprintf(stderr, "[image_io] stbi_write_png failed for '%s'\n", path);
-        return -1;
-    }
-    return 0;
+    return png_write(path, img, png_level(), num_threads);
+}
+
+int image_save_png(const char* path, const Image* img)
+{
+    return save_png(path, img, 0);
 }
 
 int image_load(const char* path, Image* img)
@@ -154,6 +385,8 @@ int image_load(const char* path, Image* img)
         return image_load_ppm(path, img);
     } else if (strcmp(ext, ".png") == 0 || strcmp(ext, ".PNG") == 0) {
         return image_load_png(path, img);
+    } else if (strcmp(ext, ".qoi") == 0 || strcmp(ext, ".QOI") == 0) {
+        return qoi_load(path, img);
     } else {
         fprintf(stderr, "[image_io] Unsupported file extension '%s'\n", ext);
         return -1;
@@ -161,6 +394,11 @@ int image_load(const char* path, Image* img)
 }
 
 int image_save(const char* path, const Image* img)
+{
+    return image_save_threads(path, img, 0);
+}
+
+int image_save_threads(const char* path, const Image* img, int num_threads)
 {
     if (create_output_directories(path) != 0) {
         fprintf(stderr, "[image_io] Cannot create directory for '%s'\n", path);
@@ -176,7 +414,9 @@ int image_save(const char* path, const Image* img)
     if (strcmp(ext, ".ppm") == 0 || strcmp(ext, ".PPM") == 0) {
         return image_save_ppm(path, img);
     } else if (strcmp(ext, ".png") == 0 || strcmp(ext, ".PNG") == 0) {
-        return image_save_png(path, img);
+        return save_png(path, img, num_threads);
+    } else if (strcmp(ext, ".qoi") == 0 || strcmp(ext, ".QOI") == 0) {
+        return qoi_save(path, img, num_threads);
     } else {
         fprintf(stderr, "[image_io] Unsupported file extension '%s'\n", ext);
         return -1;
@@ -188,17 +428,20 @@ int image_alloc(Image* img, int width, int height, int channels)
     img->width    = width;
     img->height   = height;
     img->channels = channels;
-    img->pixels   = (uint8_t*)malloc((size_t)width * height * channels);
+    size_t size   = (size_t)width * height * channels;
+    img->pixels   = pixel_alloc(size);
     if (!img->pixels) {
         fprintf(stderr, "[image_io] Out of memory\n");
         return -1;
     }
+    pixel_first_touch(img->pixels, size);
     return 0;
 }
 
 void image_free(Image* img)
 {
-    free(img->pixels);
+    pixel_free(img->pixels,
+               (size_t)img->width * img->height * img->channels);
     img->pixels = NULL;
 }
 
@@ -208,12 +451,12 @@ int image_copy(Image* dst, const Image* src)
     dst->height   = src->height;
     dst->channels = src->channels;
     size_t n      = (size_t)src->width * src->height * src->channels;
-    dst->pixels   = (uint8_t*)malloc(n);
+    dst->pixels   = pixel_alloc(n);
     if (!dst->pixels) {
         fprintf(stderr, "[image_io] Out of memory in image_copy\n");
         return -1;
     }
-    memcpy(dst->pixels, src->pixels, n);
+    pixel_copy(dst->pixels, src->pixels, n);
     return 0;
 }
 
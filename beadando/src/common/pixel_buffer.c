@@ -0,0 +1,476 @@
+#if !defined(_WIN32)
+#  define _GNU_SOURCE
+#endif
+
+#include "common/pixel_buffer.h"
+
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#  include <malloc.h>
+#else
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
+
+#if defined(__linux__)
+#  include <sys/syscall.h>
+#  define MPOL_INTERLEAVE_MODE 3
+#  define MPOL_F_MEMS_ALLOWED_FLAG (1 << 2)
+#endif
+
+/* Smallest buffer worth pooling or interleaving */
+#define PIXEL_CHUNK  (256u * 1024u)
+#define HUGE_PAGE    (2u * 1024u * 1024u)
+#define SMALL_PAGE   4096u
+
+/*
+ * Every buffer is preceded by one cache line of bookkeeping, so pixel_free
+ * knows how it was obtained and the pixels start 64-byte aligned.
+ */
+#define PIXEL_HEADER 64u
+
+typedef enum { BACKING_HEAP, BACKING_MMAP } Backing;
+
+typedef struct PixelHeader {
+    void*   base;      /* start of the allocation (header included) */
+    size_t  length;    /* mapping length for BACKING_MMAP           */
+    Backing backing;
+    int     resident;  /* recycled from the pool: pages already in  */
+    size_t  capacity;  /* usable bytes (size class), 0 = not pooled */
+    struct PixelHeader* next;   /* idle list link                   */
+} PixelHeader;
+
+static NumaPolicy numa_policy = NUMA_POLICY_FIRST_TOUCH;
+static int        huge_pages  = 1;
+
+/* Idle pooled buffers; every access is in omp critical(pixel_pool) */
+static size_t       pool_limit = 0;
+static size_t       pool_idle_bytes = 0;
+static size_t       pool_hits = 0, pool_misses = 0;
+static PixelHeader* pool_idle = NULL;
+
+void pixel_set_numa_policy(NumaPolicy policy)
+{
+    numa_policy = policy;
+}
+
+NumaPolicy pixel_numa_policy(void)
+{
+    return numa_policy;
+}
+
+int pixel_parse_numa_policy(const char* name, NumaPolicy* policy)
+{
+    if (strcmp(name, "none") == 0)             *policy = NUMA_POLICY_NONE;
+    else if (strcmp(name, "first-touch") == 0) *policy = NUMA_POLICY_FIRST_TOUCH;
+    else if (strcmp(name, "interleave") == 0)  *policy = NUMA_POLICY_INTERLEAVE;
+    else return -1;
+    return 0;
+}
+
+/* Interleave [buf, buf+size) over every node the cpuset allows. */
+static void apply_interleave(uint8_t* buf, size_t size)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+    /* mbind wants a page-aligned start; only whole pages inside buf */
+    uintptr_t page  = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)buf + page - 1) & ~(page - 1);
+    uintptr_t end   = ((uintptr_t)buf + size) & ~(page - 1);
+    if (end <= start)
+        return;
+    buf  = (uint8_t*)start;
+    size = end - start;
+
+    /*
+     * An all-ones mask names nodes the kernel does not have and mbind
+     * rejects it (EINVAL when MAX_NUMNODES is smaller than the mask).
+     * Ask for the allowed set instead and pass just enough bits for it.
+     */
+    unsigned long nodemask[16];
+    const unsigned long bits = sizeof(nodemask[0]) * 8;
+    memset(nodemask, 0, sizeof(nodemask));
+    if (syscall(SYS_get_mempolicy, NULL, nodemask, sizeof(nodemask) * 8,
+                NULL, MPOL_F_MEMS_ALLOWED_FLAG) != 0)
+        return;
+    unsigned long maxnode = 0;
+    for (unsigned long n = 0; n < sizeof(nodemask) * 8; n++)
+        if (nodemask[n / bits] & (1UL << (n % bits)))
+            maxnode = n + 1;
+    if (maxnode <= 1)
+        return;                         /* one node: nothing to spread */
+
+    /* The kernel drops the last bit of maxnode, hence the + 1 */
+    if (syscall(SYS_mbind, buf, size, MPOL_INTERLEAVE_MODE, nodemask,
+                maxnode + 1, 0) != 0) {
+        static int warned = 0;
+        if (!warned) {
+            perror("[pixel_buffer] mbind(MPOL_INTERLEAVE)");
+            warned = 1;
+        }
+    }
+#else
+    (void)buf; (void)size;
+#endif
+}
+
+void pixel_set_huge_pages(int enabled)
+{
+    huge_pages = enabled;
+}
+
+int pixel_huge_pages(void)
+{
+    return huge_pages;
+}
+
+static uint8_t* finish_alloc(void* base, size_t length, Backing backing)
+{
+    PixelHeader* h = (PixelHeader*)base;
+    h->base     = base;
+    h->length   = length;
+    h->backing  = backing;
+    h->resident = 0;
+    h->capacity = 0;
+    h->next     = NULL;
+    return (uint8_t*)base + PIXEL_HEADER;
+}
+
+#if !defined(_WIN32)
+/*
+ * 2 MiB-aligned anonymous mapping: explicit MAP_HUGETLB pages if the
+ * administrator reserved any, otherwise ordinary pages with a THP hint.
+ * Returns NULL if even the plain mapping fails.
+ */
+static void* map_huge(size_t length)
+{
+#if defined(MAP_HUGETLB)
+    void* p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+        return p;
+#endif
+
+    /* Over-map by one huge page, then trim to a 2 MiB boundary */
+    size_t span = length + HUGE_PAGE;
+    uint8_t* raw = (uint8_t*)mmap(NULL, span, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+
+    uintptr_t aligned = ((uintptr_t)raw + HUGE_PAGE - 1)
+                      & ~(uintptr_t)(HUGE_PAGE - 1);
+    size_t head = aligned - (uintptr_t)raw;
+    size_t tail = span - head - length;
+    if (head) munmap(raw, head);
+    if (tail) munmap((uint8_t*)aligned + length, tail);
+
+#if defined(MADV_HUGEPAGE)
+    madvise((void*)aligned, length, MADV_HUGEPAGE);
+#endif
+    return (void*)aligned;
+}
+#endif
+
+static uint8_t* alloc_backing(size_t size)
+{
+    size_t total = size + PIXEL_HEADER;
+
+#if !defined(_WIN32)
+    if (huge_pages && size >= HUGE_PAGE) {
+        size_t length = (total + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        void* base = map_huge(length);
+        if (base) {
+            if (numa_policy == NUMA_POLICY_INTERLEAVE)
+                apply_interleave((uint8_t*)base, length);
+            return finish_alloc(base, length, BACKING_MMAP);
+        }
+        /* fall through to the heap */
+    }
+
+    void* base = NULL;
+    if (posix_memalign(&base, PIXEL_HEADER, total) != 0)
+        return NULL;
+    if (numa_policy == NUMA_POLICY_INTERLEAVE && size >= PIXEL_CHUNK)
+        apply_interleave((uint8_t*)base, total);
+#else
+    void* base = _aligned_malloc(total, PIXEL_HEADER);
+    if (!base)
+        return NULL;
+#endif
+    return finish_alloc(base, total, BACKING_HEAP);
+}
+
+static void release_backing(const PixelHeader* h)
+{
+#if !defined(_WIN32)
+    if (h->backing == BACKING_MMAP) {
+        munmap(h->base, h->length);
+        return;
+    }
+    free(h->base);
+#else
+    _aligned_free(h->base);
+#endif
+}
+
+static PixelHeader* header_of(uint8_t* buf)
+{
+    return (PixelHeader*)(buf - PIXEL_HEADER);
+}
+
+/* Size class: four steps per power of two, so reuse wastes <= 25% */
+static size_t pool_class(size_t size)
+{
+    int msb = 63 - __builtin_clzll((unsigned long long)size);
+    size_t step = (size_t)1 << (msb - 2);
+    return (size + step - 1) & ~(step - 1);
+}
+
+void pixel_pool_set_limit(size_t bytes)
+{
+    pool_limit = bytes;
+    pixel_pool_trim();
+}
+
+size_t pixel_pool_limit(void)
+{
+    return pool_limit;
+}
+
+void pixel_pool_trim(void)
+{
+    PixelHeader* list;
+    #pragma omp critical(pixel_pool)
+    {
+        list = pool_idle;
+        pool_idle = NULL;
+        pool_idle_bytes = 0;
+    }
+    while (list) {
+        PixelHeader* next = list->next;
+        release_backing(list);
+        list = next;
+    }
+}
+
+void pixel_pool_stats(PixelPoolStats* st)
+{
+    #pragma omp critical(pixel_pool)
+    {
+        st->hits       = pool_hits;
+        st->misses     = pool_misses;
+        st->idle_bytes = pool_idle_bytes;
+    }
+}
+
+/* Hand buf to the idle list; 0 if the limit left no room */
+static int pool_put(PixelHeader* h)
+{
+    int kept = 0;
+    #pragma omp critical(pixel_pool)
+    {
+        if (pool_idle_bytes + h->capacity <= pool_limit) {
+            h->resident = 1;
+            h->next     = pool_idle;
+            pool_idle   = h;
+            pool_idle_bytes += h->capacity;
+            kept = 1;
+        }
+    }
+    return kept;
+}
+
+uint8_t* pixel_alloc(size_t size)
+{
+    if (pool_limit == 0 || size < PIXEL_CHUNK)
+        return alloc_backing(size);
+
+    size_t       cap = pool_class(size);
+    PixelHeader* hit = NULL;
+    #pragma omp critical(pixel_pool)
+    {
+        for (PixelHeader** link = &pool_idle; *link; link = &(*link)->next) {
+            if ((*link)->capacity == cap) {
+                hit   = *link;
+                *link = hit->next;
+                pool_idle_bytes -= cap;
+                break;
+            }
+        }
+        if (hit) pool_hits++;
+        else     pool_misses++;
+    }
+    if (hit)
+        return (uint8_t*)hit + PIXEL_HEADER;
+
+    uint8_t* buf = alloc_backing(cap);
+    if (buf)
+        header_of(buf)->capacity = cap;
+    return buf;
+}
+
+int pixel_pool_reserve(size_t size, int count)
+{
+    if (pool_limit == 0 || size < PIXEL_CHUNK)
+        return 0;
+    size_t cap = pool_class(size);
+
+    for (int i = 0; i < count; i++) {
+        uint8_t* buf = alloc_backing(cap);
+        if (!buf)
+            return -1;
+        PixelHeader* h = header_of(buf);
+        h->capacity = cap;
+
+        /* fault the pages in with the placement map, whatever the policy */
+        #pragma omp parallel
+        {
+            size_t begin, end;
+            pixel_place_range(buf, cap, omp_get_thread_num(),
+                              omp_get_num_threads(), &begin, &end);
+            memset(buf + begin, 0, end - begin);
+        }
+
+        if (!pool_put(h)) {
+            release_backing(h);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#if !defined(_WIN32)
+uint8_t* pixel_map_file(int fd, uint64_t offset, size_t size, int writable)
+{
+    size_t   page    = (size_t)sysconf(_SC_PAGESIZE);
+    uint64_t aligned = offset & ~(uint64_t)(page - 1);
+    size_t   delta   = (size_t)(offset - aligned);
+    size_t   length  = delta + size;
+    int      prot    = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    uint8_t* base;
+    uint8_t* pixels;
+    size_t   total;
+
+    if (delta >= PIXEL_HEADER) {
+        /* The header fits in front of the raster, inside the first page */
+        base = (uint8_t*)mmap(NULL, length, prot, MAP_PRIVATE, fd,
+                              (off_t)aligned);
+        if (base == MAP_FAILED)
+            return NULL;
+        total = length;
+    } else {
+        /* One anonymous page in front holds the header */
+        base = (uint8_t*)mmap(NULL, page + length, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return NULL;
+        if (mmap(base + page, length, prot, MAP_PRIVATE | MAP_FIXED, fd,
+                 (off_t)aligned) == MAP_FAILED) {
+            munmap(base, page + length);
+            return NULL;
+        }
+        total = page + length;
+    }
+    pixels = base + total - size;
+
+    /*
+     * A read-only mapping gets write access on the header's page just long
+     * enough to store it (one private copy); the raster stays read-only.
+     */
+    uint8_t* hdr_page = (uint8_t*)((uintptr_t)(pixels - PIXEL_HEADER)
+                                   & ~(uintptr_t)(page - 1));
+    size_t   hdr_span = (size_t)(pixels - hdr_page);
+    int relock = !writable && delta >= PIXEL_HEADER;
+    if (relock && mprotect(hdr_page, hdr_span, PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, total);            /* caller falls back to reading */
+        return NULL;
+    }
+
+    PixelHeader h = { base, total, BACKING_MMAP, 0, 0, NULL };
+    memcpy(pixels - PIXEL_HEADER, &h, sizeof(h));
+
+    if (relock && mprotect(hdr_page, hdr_span, PROT_READ) != 0) {
+        munmap(base, total);
+        return NULL;
+    }
+    return pixels;
+}
+#else
+uint8_t* pixel_map_file(int fd, uint64_t offset, size_t size, int writable)
+{
+    (void)fd; (void)offset; (void)size; (void)writable;
+    return NULL;
+}
+#endif
+
+void pixel_free(uint8_t* buf, size_t size)
+{
+    (void)size;
+    if (!buf) return;
+
+    /* memcpy: mapped buffers put the header at an unaligned address */
+    PixelHeader h;
+    memcpy(&h, buf - PIXEL_HEADER, sizeof(h));
+    if (h.capacity && pool_limit && pool_put(header_of(buf)))
+        return;
+    release_backing(&h);
+}
+
+void pixel_place_range(const uint8_t* buf, size_t size, int part, int parts,
+                       size_t* begin, size_t* end)
+{
+    /* whole pages only: boundaries sit on unit multiples of the address */
+    size_t unit  = huge_pages && size >= HUGE_PAGE ? HUGE_PAGE : SMALL_PAGE;
+    size_t lead  = (unit - (uintptr_t)buf % unit) % unit;
+    if (lead > size)
+        lead = size;
+    size_t units = (size - lead + unit - 1) / unit;
+
+    /* OpenMP's static split: the first `extra` parts take one unit more */
+    size_t q = units / (size_t)parts, extra = units % (size_t)parts;
+    size_t p = (size_t)part;
+    size_t u0 = p * q + (p < extra ? p : extra);
+    size_t u1 = u0 + q + (p < extra ? 1 : 0);
+
+    /* the partial leading page goes with part 0, the tail with the last */
+    *begin = part == 0 ? 0 : lead + u0 * unit;
+    *end   = part == parts - 1 ? size : lead + u1 * unit;
+    if (*begin > size) *begin = size;
+    if (*end > size)   *end   = size;
+    if (*end < *begin) *end   = *begin;
+}
+
+void pixel_first_touch(uint8_t* buf, size_t size)
+{
+    if (numa_policy == NUMA_POLICY_NONE || header_of(buf)->resident)
+        return;
+
+    #pragma omp parallel
+    {
+        size_t begin, end;
+        pixel_place_range(buf, size, omp_get_thread_num(),
+                          omp_get_num_threads(), &begin, &end);
+        memset(buf + begin, 0, end - begin);
+    }
+}
+
+void pixel_copy(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    if (numa_policy == NUMA_POLICY_NONE) {
+        memcpy(dst, src, size);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        size_t begin, end;
+        pixel_place_range(dst, size, omp_get_thread_num(),
+                          omp_get_num_threads(), &begin, &end);
+        memcpy(dst + begin, src + begin, end - begin);
+    }
+}
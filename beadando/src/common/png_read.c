@@ -0,0 +1,605 @@
+#include "common/png_read.h"
+#include "common/pixel_buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#  define PNG_READ_SSE2 1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define PNG_READ_LE 1
+#endif
+
+#define PAD_BYTES   16      /* zero tail so the bit reader can over-read  */
+#define COPY_SLACK  16      /* output over-copy room for word-wise matches */
+
+/* ======================================================================
+ * Inflate (RFC 1950/1951)
+ * ====================================================================== */
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;     /* end of real input (PAD_BYTES zeros follow) */
+    uint64_t       bits;
+    int            n;
+} BitReader;
+
+/* Top the buffer up to at least 56 bits */
+static inline void refill(BitReader* r)
+{
+#ifdef PNG_READ_LE
+    if (r->p + 8 <= r->end + PAD_BYTES) {
+        uint64_t w;
+        memcpy(&w, r->p, 8);
+        r->bits |= w << r->n;
+        r->p    += (63 - r->n) >> 3;
+        r->n    |= 56;
+        return;
+    }
+#endif
+    while (r->n <= 56) {
+        uint64_t b = r->p < r->end + PAD_BYTES ? *r->p : 0;
+        r->p++;
+        r->bits |= b << r->n;
+        r->n    += 8;
+    }
+}
+
+static inline uint32_t take(BitReader* r, int n)
+{
+    uint32_t v = (uint32_t)(r->bits & ((1ull << n) - 1));
+    r->bits >>= n;
+    r->n     -= n;
+    return v;
+}
+
+/* True once more than the padding has been consumed: input truncated */
+static inline int overrun(const BitReader* r)
+{
+    return r->p - r->n / 8 > r->end;
+}
+
+#define FAST_BITS 10
+#define FAST_MASK ((1u << FAST_BITS) - 1)
+
+typedef struct {
+    uint16_t fast[1 << FAST_BITS];  /* sym << 4 | len, 0 = longer code */
+    uint16_t count[16];
+    uint16_t symbol[288];
+} Huffman;
+
+static int huff_build(Huffman* h, const uint8_t* len, int n)
+{
+    uint16_t offs[16], next[16];
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+    for (int i = 0; i < n; i++)
+        h->count[len[i]]++;
+    h->count[0] = 0;
+
+    int left = 1;
+    for (int b = 1; b < 16; b++) {
+        left = (left << 1) - h->count[b];
+        if (left < 0)
+            return -1;                  /* over-subscribed */
+    }
+
+    offs[1] = 0;
+    for (int b = 1; b < 15; b++)
+        offs[b + 1] = (uint16_t)(offs[b] + h->count[b]);
+    for (int i = 0; i < n; i++)
+        if (len[i])
+            h->symbol[offs[len[i]]++] = (uint16_t)i;
+
+    uint16_t code = 0;
+    for (int b = 1; b < 16; b++) {
+        next[b] = code;
+        code    = (uint16_t)((code + h->count[b]) << 1);
+    }
+
+    for (int i = 0; i < n; i++) {
+        int l = len[i];
+        if (l == 0 || l > FAST_BITS) {
+            if (l) next[l]++;
+            continue;
+        }
+        uint32_t c = next[l]++, rev = 0;
+        for (int k = 0; k < l; k++)
+            rev |= ((c >> k) & 1u) << (l - 1 - k);
+        for (uint32_t j = rev; j <= FAST_MASK; j += 1u << l)
+            h->fast[j] = (uint16_t)((i << 4) | l);
+    }
+    return 0;
+}
+
+/* Canonical bit-by-bit decode for codes longer than FAST_BITS */
+static int decode_slow(BitReader* r, const Huffman* h)
+{
+    int code = 0, first = 0, index = 0;
+    for (int l = 1; l < 16; l++) {
+        code |= (int)take(r, 1);
+        int count = h->count[l];
+        if (code - first < count)
+            return h->symbol[index + code - first];
+        index += count;
+        first  = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static inline int decode(BitReader* r, const Huffman* h)
+{
+    uint32_t e = h->fast[r->bits & FAST_MASK];
+    if (e) {
+        r->bits >>= e & 15;
+        r->n     -= (int)(e & 15);
+        return (int)(e >> 4);
+    }
+    return decode_slow(r, h);
+}
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t clen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static void build_fixed(Huffman* lit, Huffman* dist)
+{
+    uint8_t len[288];
+    for (int i = 0; i < 288; i++)
+        len[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    huff_build(lit, len, 288);
+    for (int i = 0; i < 30; i++)
+        len[i] = 5;
+    huff_build(dist, len, 30);
+}
+
+static int read_dynamic(BitReader* r, Huffman* lit, Huffman* dist)
+{
+    uint8_t len[286 + 30], clen[19] = {0};
+    Huffman cl;
+
+    refill(r);
+    int nlit  = (int)take(r, 5) + 257;
+    int ndist = (int)take(r, 5) + 1;
+    int nclen = (int)take(r, 4) + 4;
+    if (nlit > 286 || ndist > 30)
+        return -1;
+    for (int i = 0; i < nclen; i++) {
+        refill(r);
+        clen[clen_order[i]] = (uint8_t)take(r, 3);
+    }
+    if (huff_build(&cl, clen, 19) != 0)
+        return -1;
+
+    for (int i = 0; i < nlit + ndist;) {
+        refill(r);
+        int sym = decode(r, &cl);
+        if (sym < 0)
+            return -1;
+        if (sym < 16) {
+            len[i++] = (uint8_t)sym;
+            continue;
+        }
+        int rep, val = 0;
+        if (sym == 16) {
+            if (i == 0) return -1;
+            val = len[i - 1];
+            rep = 3 + (int)take(r, 2);
+        } else if (sym == 17) {
+            rep = 3 + (int)take(r, 3);
+        } else {
+            rep = 11 + (int)take(r, 7);
+        }
+        if (i + rep > nlit + ndist)
+            return -1;
+        while (rep--)
+            len[i++] = (uint8_t)val;
+    }
+    if (len[256] == 0)
+        return -1;
+    if (huff_build(lit, len, nlit) != 0 || huff_build(dist, len + nlit, ndist) != 0)
+        return -1;
+    return overrun(r) ? -1 : 0;
+}
+
+/* Decode one Huffman block into out; returns the new write position */
+static uint8_t* inflate_codes(BitReader* r, const Huffman* lit,
+                              const Huffman* dist, uint8_t* base,
+                              uint8_t* out, uint8_t* out_end)
+{
+    for (;;) {
+        refill(r);
+        int sym = decode(r, lit);
+        if (sym < 256) {
+            if (sym < 0 || out >= out_end)
+                return NULL;
+            *out++ = (uint8_t)sym;
+            continue;
+        }
+        if (sym == 256)
+            return overrun(r) ? NULL : out;
+
+        sym -= 257;
+        if (sym >= 29)
+            return NULL;
+        int len = len_base[sym] + (int)take(r, len_extra[sym]);
+        int dc  = decode(r, dist);
+        if (dc < 0 || dc >= 30)
+            return NULL;
+        size_t d = dist_base[dc] + take(r, dist_extra[dc]);
+        if (d > (size_t)(out - base) || len > out_end - out)
+            return NULL;
+
+        const uint8_t* src = out - d;
+        uint8_t*       dst = out;
+        out += len;
+        if (d >= 8) {
+            /* out_end has COPY_SLACK bytes behind it for the last word */
+            do {
+                memcpy(dst, src, 8);
+                dst += 8;
+                src += 8;
+            } while (dst < out);
+        } else if (d == 1) {
+            memset(dst, *src, (size_t)len);
+        } else {
+            while (dst < out)
+                *dst++ = *src++;
+        }
+    }
+}
+
+/* Inflate a zlib stream into out[0, size); it must fill it exactly */
+static int inflate_zlib(const uint8_t* in, size_t n_in, uint8_t* out, size_t size)
+{
+    if (n_in < 2 || (in[0] & 0x0f) != 8 || (in[0] >> 4) > 7
+        || ((in[0] << 8) | in[1]) % 31 != 0 || (in[1] & 0x20))
+        return -1;
+
+    BitReader r = { in + 2, in + n_in, 0, 0 };
+    Huffman   lit, dist;
+    uint8_t*  pos = out;
+    uint8_t*  end = out + size;
+    int       final;
+
+    do {
+        refill(&r);
+        final    = (int)take(&r, 1);
+        int type = (int)take(&r, 2);
+
+        if (type == 0) {
+            take(&r, r.n & 7);
+            r.p   -= r.n / 8;
+            r.bits = 0;
+            r.n    = 0;
+            if (r.end - r.p < 4)
+                return -1;
+            size_t len  = (size_t)r.p[0] | ((size_t)r.p[1] << 8);
+            size_t nlen = (size_t)r.p[2] | ((size_t)r.p[3] << 8);
+            r.p += 4;
+            if ((len ^ 0xffff) != nlen || len > (size_t)(r.end - r.p)
+                || len > (size_t)(end - pos))
+                return -1;
+            memcpy(pos, r.p, len);
+            pos += len;
+            r.p += len;
+        } else if (type == 1 || type == 2) {
+            if (type == 1)
+                build_fixed(&lit, &dist);
+            else if (read_dynamic(&r, &lit, &dist) != 0)
+                return -1;
+            pos = inflate_codes(&r, &lit, &dist, out, pos, end);
+            if (!pos)
+                return -1;
+        } else {
+            return -1;
+        }
+    } while (!final);
+
+    return pos == end ? 0 : -1;
+}
+
+/* ======================================================================
+ * Unfiltering
+ *
+ * out = unfiltered row, in = filtered row, prev = unfiltered previous
+ * row (zeros for the first one), n bytes, bpp bytes per pixel.
+ * ====================================================================== */
+
+#ifndef PNG_READ_SSE2
+
+static void unfilter_scalar(int type, uint8_t* out, const uint8_t* in,
+                            const uint8_t* prev, size_t n, int bpp)
+{
+    size_t i;
+    switch (type) {
+    case 0:
+        memcpy(out, in, n);
+        break;
+    case 1:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = in[i];
+        for (; i < n; i++) out[i] = (uint8_t)(in[i] + out[i - bpp]);
+        break;
+    case 2:
+        for (i = 0; i < n; i++) out[i] = (uint8_t)(in[i] + prev[i]);
+        break;
+    case 3:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = (uint8_t)(in[i] + (prev[i] >> 1));
+        for (; i < n; i++)
+            out[i] = (uint8_t)(in[i] + ((out[i - bpp] + prev[i]) >> 1));
+        break;
+    default:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = (uint8_t)(in[i] + prev[i]);
+        for (; i < n; i++) {
+            int a = out[i - bpp], b = prev[i], c = prev[i - bpp];
+            int p = a + b - c;
+            int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+            out[i] = (uint8_t)(in[i] + (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+        }
+        break;
+    }
+}
+
+#else
+
+/* One 3- or 4-byte pixel in the low lanes of a register */
+static inline __m128i load_px(const uint8_t* p, int bpp)
+{
+    uint32_t v = 0;
+    memcpy(&v, p, (size_t)bpp);
+    return _mm_cvtsi32_si128((int)v);
+}
+
+static inline void store_px(uint8_t* p, __m128i v, int bpp)
+{
+    uint32_t w = (uint32_t)_mm_cvtsi128_si32(v);
+    memcpy(p, &w, (size_t)bpp);
+}
+
+/*
+ * Sub/Average/Paeth depend on the pixel to the left, so the vector
+ * holds one pixel and walks the row; Up is independent and runs 16
+ * bytes at a time.
+ */
+static void unfilter_sse2(int type, uint8_t* out, const uint8_t* in,
+                          const uint8_t* prev, size_t n, int bpp)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero;
+    size_t  i = 0;
+
+    switch (type) {
+    case 1:
+        for (; i < n; i += (size_t)bpp) {
+            a = _mm_add_epi8(load_px(in + i, bpp), a);
+            store_px(out + i, a, bpp);
+        }
+        break;
+    case 2:
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(in + i)),
+                                     _mm_loadu_si128((const __m128i*)(prev + i)));
+            _mm_storeu_si128((__m128i*)(out + i), v);
+        }
+        for (; i < n; i++)
+            out[i] = (uint8_t)(in[i] + prev[i]);
+        break;
+    case 3: {
+        const __m128i one = _mm_set1_epi8(1);
+        for (; i < n; i += (size_t)bpp) {
+            __m128i b   = load_px(prev + i, bpp);
+            /* avg_epu8 rounds up; floor((a + b) / 2) drops the odd bit */
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+                                       _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_add_epi8(load_px(in + i, bpp), avg);
+            store_px(out + i, a, bpp);
+        }
+        break;
+    }
+    case 4: {
+        /* 16-bit lanes: a, b, c and the predictor distances */
+        __m128i c = zero;
+        for (; i < n; i += (size_t)bpp) {
+            __m128i b  = _mm_unpacklo_epi8(load_px(prev + i, bpp), zero);
+            __m128i x  = _mm_unpacklo_epi8(load_px(in + i, bpp), zero);
+            __m128i sa = _mm_sub_epi16(b, c);
+            __m128i sb = _mm_sub_epi16(a, c);
+            __m128i sc = _mm_add_epi16(sa, sb);
+            __m128i pa = _mm_max_epi16(sa, _mm_sub_epi16(zero, sa));
+            __m128i pb = _mm_max_epi16(sb, _mm_sub_epi16(zero, sb));
+            __m128i pc = _mm_max_epi16(sc, _mm_sub_epi16(zero, sc));
+            __m128i lo = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+            /* priority a, b, c: blend c, then b, then a over it */
+            __m128i m    = _mm_cmpeq_epi16(pb, lo);
+            __m128i pred = _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, c));
+            m    = _mm_cmpeq_epi16(pa, lo);
+            pred = _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, pred));
+
+            a = _mm_and_si128(_mm_add_epi16(x, pred), _mm_set1_epi16(0xff));
+            store_px(out + i, _mm_packus_epi16(a, a), bpp);
+            c = b;
+        }
+        break;
+    }
+    default:
+        memcpy(out, in, n);
+        break;
+    }
+}
+
+#endif /* !PNG_READ_SSE2 */
+
+static inline void unfilter(int type, uint8_t* out, const uint8_t* in,
+                            const uint8_t* prev, size_t n, int bpp)
+{
+#ifdef PNG_READ_SSE2
+    unfilter_sse2(type, out, in, prev, n, bpp);
+#else
+    unfilter_scalar(type, out, in, prev, n, bpp);
+#endif
+}
+
+/* ======================================================================
+ * Container
+ * ====================================================================== */
+
+static uint32_t be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+         | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint8_t* read_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    uint8_t* buf = NULL;
+    long len;
+    if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0
+        && fseek(f, 0, SEEK_SET) == 0) {
+        buf = (uint8_t*)malloc((size_t)len + PAD_BYTES);
+        if (buf && fread(buf, 1, (size_t)len, f) != (size_t)len) {
+            free(buf);
+            buf = NULL;
+        }
+        *size = (size_t)len;
+    }
+    fclose(f);
+    return buf;
+}
+
+/*
+ * Walk the chunks, check IHDR is on the fast path and move all IDAT
+ * payloads together at the front of buf.  Returns the zlib stream size.
+ */
+static int collect_idat(uint8_t* buf, size_t size, int* w, int* h,
+                        int* bpp, size_t* n_idat)
+{
+    static const uint8_t sig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    if (size < 8 + 25 || memcmp(buf, sig, 8) != 0)
+        return -1;
+
+    const uint8_t* ihdr = buf + 16;
+    if (be32(buf + 8) != 13 || memcmp(buf + 12, "IHDR", 4) != 0)
+        return -1;
+    *w = (int)be32(ihdr);
+    *h = (int)be32(ihdr + 4);
+    if (*w <= 0 || *h <= 0 || ihdr[8] != 8 || ihdr[10] != 0
+        || ihdr[11] != 0 || ihdr[12] != 0)
+        return -1;
+    if (ihdr[9] == 2)      *bpp = 3;
+    else if (ihdr[9] == 6) *bpp = 4;
+    else                   return -1;
+
+    size_t pos = 33, out = 0;
+    while (pos + 12 <= size) {
+        size_t len = be32(buf + pos);
+        const uint8_t* type = buf + pos + 4;
+        if (len > size - pos - 12)
+            return -1;
+        if (memcmp(type, "IDAT", 4) == 0) {
+            memmove(buf + out, buf + pos + 8, len);
+            out += len;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        } else if (memcmp(type, "CgBI", 4) == 0) {
+            return -1;              /* Apple variant: stb handles it */
+        }
+        pos += 12 + len;
+    }
+    *n_idat = out;
+    return out > 0 ? 0 : -1;
+}
+
+int png_read(const char* path, Image* img)
+{
+    size_t size = 0, n_idat = 0;
+    uint8_t* file = read_file(path, &size);
+    if (!file)
+        return -1;
+
+    int w, h, bpp;
+    if (collect_idat(file, size, &w, &h, &bpp, &n_idat) != 0
+        || (size_t)w > (SIZE_MAX / 4 - 1) / (size_t)h) {
+        free(file);
+        return -1;
+    }
+    memset(file + n_idat, 0, PAD_BYTES);
+
+    size_t row   = (size_t)w * bpp;
+    size_t total = (row + 1) * (size_t)h;
+    uint8_t* raw = (uint8_t*)malloc(total + COPY_SLACK);
+    if (!raw || inflate_zlib(file, n_idat, raw, total) != 0) {
+        free(raw);
+        free(file);
+        return -1;
+    }
+    free(file);
+
+    size_t   stride = (size_t)w * 3;
+    uint8_t* pixels = pixel_alloc(stride * (size_t)h);
+    /* unfiltering is serial: place the pages first, as image_alloc does */
+    if (pixels)
+        pixel_first_touch(pixels, stride * (size_t)h);
+    /* zero row, plus two RGBA rows (current / previous) when bpp == 4 */
+    uint8_t* scratch = (uint8_t*)calloc(bpp == 4 ? 3 * row : row, 1);
+    int ok = pixels && scratch;
+
+    const uint8_t* prev = scratch;
+    for (int y = 0; ok && y < h; y++) {
+        const uint8_t* in   = raw + (size_t)y * (row + 1);
+        uint8_t*       dst  = pixels + (size_t)y * stride;
+        if (in[0] > 4) {
+            ok = 0;
+            break;
+        }
+        if (bpp == 3) {
+            unfilter(in[0], dst, in + 1, prev, row, 3);
+            prev = dst;
+        } else {
+            uint8_t* cur = scratch + row * (size_t)(1 + (y & 1));
+            unfilter(in[0], cur, in + 1, prev, row, 4);
+            for (int x = 0; x < w; x++) {
+                dst[3 * x]     = cur[4 * x];
+                dst[3 * x + 1] = cur[4 * x + 1];
+                dst[3 * x + 2] = cur[4 * x + 2];
+            }
+            prev = cur;
+        }
+    }
+
+    free(scratch);
+    free(raw);
+    if (!ok) {
+        pixel_free(pixels, stride * (size_t)h);
+        return -1;
+    }
+    img->pixels   = pixels;
+    img->width    = w;
+    img->height   = h;
+    img->channels = 3;
+    return 0;
+}
@@ -0,0 +1,855 @@
+#include "common/png_write.h"
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Filtered bytes per deflate chunk (one IDAT each) */
+#define CHUNK_SIZE    (256u * 1024u)
+#define WINDOW_SIZE   32768
+#define WINDOW_MASK   (WINDOW_SIZE - 1)
+#define HASH_BITS     15
+#define HASH_SIZE     (1 << HASH_BITS)
+#define MIN_MATCH     3
+#define MAX_MATCH     258
+#define TOO_FAR       4096      /* 3-byte matches further back cost more */
+#define BLOCK_TOKENS  16384     /* LZ77 tokens per deflate block          */
+
+static int png_default_level = PNG_LEVEL_DEFAULT;
+
+void png_set_level(int level)
+{
+    if (level < PNG_LEVEL_MIN) level = PNG_LEVEL_MIN;
+    if (level > PNG_LEVEL_MAX) level = PNG_LEVEL_MAX;
+    png_default_level = level;
+}
+
+int png_level(void)
+{
+    return png_default_level;
+}
+
+/* Match search effort per level */
+static const struct { int chain; int nice; int lazy; } level_params[10] = {
+    {    0,   0, 0 },   /* 0: stored           */
+    {    4,   8, 0 },
+    {    8,  16, 0 },
+    {   16,  32, 0 },
+    {   16,  32, 1 },
+    {   32,  64, 1 },
+    {   64, 128, 1 },
+    {  128, 128, 1 },
+    {  512, 258, 1 },
+    { 2048, 258, 1 },
+};
+
+/* ======================================================================
+ * Checksums
+ * ====================================================================== */
+
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#define ADLER_BASE 65521u
+#define ADLER_NMAX 5552
+
+static uint32_t adler32(const uint8_t* p, size_t n)
+{
+    uint32_t a = 1, b = 0;
+    while (n > 0) {
+        size_t k = n < ADLER_NMAX ? n : ADLER_NMAX;
+        n -= k;
+        while (k--) {
+            a += *p++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return (b << 16) | a;
+}
+
+/* Adler-32 of A||B from adler(A), adler(B) and len(B) */
+static uint32_t adler32_combine(uint32_t a1, uint32_t a2, size_t len2)
+{
+    uint32_t rem  = (uint32_t)(len2 % ADLER_BASE);
+    uint32_t sum1 = a1 & 0xffff;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % ADLER_BASE);
+    sum1 += (a2 & 0xffff) + ADLER_BASE - 1;
+    sum2 += ((a1 >> 16) & 0xffff) + ((a2 >> 16) & 0xffff) + ADLER_BASE - rem;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum2 >= (ADLER_BASE << 1)) sum2 -= (ADLER_BASE << 1);
+    if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+    return sum1 | (sum2 << 16);
+}
+
+/* ======================================================================
+ * Row filters
+ * ====================================================================== */
+
+static inline uint8_t paeth(int a, int b, int c)
+{
+    int p  = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (uint8_t)a;
+    return (uint8_t)(pb <= pc ? b : c);
+}
+
+static void filter_row(uint8_t* out, const uint8_t* row, const uint8_t* up,
+                       size_t n, int bpp, int type)
+{
+    size_t i;
+    switch (type) {
+    case 0:
+        memcpy(out, row, n);
+        break;
+    case 1:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = row[i];
+        for (; i < n; i++) out[i] = (uint8_t)(row[i] - row[i - bpp]);
+        break;
+    case 2:
+        for (i = 0; i < n; i++) out[i] = (uint8_t)(row[i] - up[i]);
+        break;
+    case 3:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = (uint8_t)(row[i] - (up[i] >> 1));
+        for (; i < n; i++)
+            out[i] = (uint8_t)(row[i] - ((row[i - bpp] + up[i]) >> 1));
+        break;
+    default:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = (uint8_t)(row[i] - up[i]);
+        for (; i < n; i++)
+            out[i] = (uint8_t)(row[i] - paeth(row[i - bpp], up[i], up[i - bpp]));
+        break;
+    }
+}
+
+/* Sum of bytes read as signed: the usual "minimum sum" heuristic */
+static size_t filter_cost(const uint8_t* p, size_t n)
+{
+    size_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += (size_t)abs((int8_t)p[i]);
+    return sum;
+}
+
+/*
+ * Filter every row into dst (stride + 1 bytes per row).  Level 0 uses
+ * filter None; otherwise each row takes the cheapest of the five.
+ */
+static int filter_image(uint8_t* dst, const Image* img, int level, int nt)
+{
+    size_t stride = (size_t)img->width * img->channels;
+    int    bpp    = img->channels;
+    int    failed = 0;
+
+    uint8_t* zero = (uint8_t*)calloc(stride, 1);
+    if (!zero) return -1;
+
+    #pragma omp parallel num_threads(nt) reduction(|:failed)
+    {
+        uint8_t* cand = level > 0 ? (uint8_t*)malloc(stride * 5) : NULL;
+        if (level > 0 && !cand)
+            failed = 1;
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < img->height; y++) {
+            const uint8_t* row = img->pixels + (size_t)y * stride;
+            const uint8_t* up  = y > 0 ? row - stride : zero;
+            uint8_t*       out = dst + (size_t)y * (stride + 1);
+
+            if (!cand) {
+                out[0] = 0;
+                memcpy(out + 1, row, stride);
+                continue;
+            }
+            int    best      = 0;
+            size_t best_cost = (size_t)-1;
+            for (int t = 0; t < 5; t++) {
+                filter_row(cand + t * stride, row, up, stride, bpp, t);
+                size_t cost = filter_cost(cand + t * stride, stride);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best      = t;
+                }
+            }
+            out[0] = (uint8_t)best;
+            memcpy(out + 1, cand + best * stride, stride);
+        }
+        free(cand);
+    }
+
+    free(zero);
+    return failed ? -1 : 0;
+}
+
+/* ======================================================================
+ * Deflate (RFC 1951)
+ * ====================================================================== */
+
+typedef struct {
+    uint8_t* buf;
+    size_t   len;
+    size_t   cap;
+    uint64_t bits;
+    int      nbits;
+    int      oom;
+} BitWriter;
+
+static void bw_reserve(BitWriter* w, size_t extra)
+{
+    if (w->len + extra <= w->cap || w->oom) return;
+    size_t cap = w->cap ? w->cap : 4096;
+    while (cap < w->len + extra) cap *= 2;
+    uint8_t* grown = (uint8_t*)realloc(w->buf, cap);
+    if (!grown) { w->oom = 1; return; }
+    w->buf = grown;
+    w->cap = cap;
+}
+
+/* Append n <= 32 bits, LSB first */
+static inline void bw_put(BitWriter* w, uint32_t value, int n)
+{
+    w->bits  |= (uint64_t)value << w->nbits;
+    w->nbits += n;
+    if (w->nbits >= 32) {
+        bw_reserve(w, 8);
+        if (w->oom) { w->nbits = 0; w->bits = 0; return; }
+        while (w->nbits >= 8) {
+            w->buf[w->len++] = (uint8_t)w->bits;
+            w->bits  >>= 8;
+            w->nbits  -= 8;
+        }
+    }
+}
+
+static void bw_align(BitWriter* w)
+{
+    bw_reserve(w, 8);
+    if (w->oom) return;
+    while (w->nbits > 0) {
+        w->buf[w->len++] = (uint8_t)w->bits;
+        w->bits  >>= 8;
+        w->nbits  = w->nbits > 8 ? w->nbits - 8 : 0;
+    }
+    w->bits = 0;
+}
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/* Order in which code-length code lengths are sent */
+static const uint8_t clen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static uint8_t  len_code[MAX_MATCH + 1];   /* match length -> 0..28   */
+static uint8_t  dist_code_lo[256];         /* distance 1..256 -> code */
+static uint8_t  dist_code_hi[256];         /* (distance-1) >> 7       */
+
+typedef struct {
+    uint16_t code[288];
+    uint8_t  len[288];
+} HuffCode;
+
+static HuffCode fixed_lit, fixed_dist;
+
+static uint16_t reverse_bits(uint16_t code, int len)
+{
+    uint16_t r = 0;
+    for (int i = 0; i < len; i++) {
+        r = (uint16_t)((r << 1) | (code & 1));
+        code >>= 1;
+    }
+    return r;
+}
+
+/* Canonical codes (bit-reversed for LSB-first output) from lengths */
+static void huff_codes(HuffCode* h, int n)
+{
+    uint16_t count[16] = {0}, next[16];
+    for (int i = 0; i < n; i++) count[h->len[i]]++;
+    count[0] = 0;
+    uint16_t code = 0;
+    for (int b = 1; b < 16; b++) {
+        code    = (uint16_t)((code + count[b - 1]) << 1);
+        next[b] = code;
+    }
+    for (int i = 0; i < n; i++)
+        if (h->len[i])
+            h->code[i] = reverse_bits(next[h->len[i]]++, h->len[i]);
+}
+
+/*
+ * Length-limited Huffman code lengths for freq[0..n).  Builds a plain
+ * Huffman tree (two-queue method over sorted leaves); if it is deeper
+ * than `limit`, the frequencies are flattened and it is rebuilt.
+ */
+static void huff_lengths(const uint32_t* freq_in, int n, int limit,
+                         uint8_t* len)
+{
+    uint32_t freq[288];
+    int      sym[288], parent[2 * 288], depth[2 * 288];
+    uint64_t weight[2 * 288];
+    memcpy(freq, freq_in, (size_t)n * sizeof(uint32_t));
+
+    for (;;) {
+        int m = 0;
+        memset(len, 0, (size_t)n);
+        for (int i = 0; i < n; i++)
+            if (freq[i]) sym[m++] = i;
+        if (m == 0) return;
+        if (m == 1) { len[sym[0]] = 1; return; }
+
+        /* insertion sort by frequency: n <= 288 */
+        for (int i = 1; i < m; i++) {
+            int s = sym[i], j = i;
+            while (j > 0 && freq[sym[j - 1]] > freq[s]) {
+                sym[j] = sym[j - 1];
+                j--;
+            }
+            sym[j] = s;
+        }
+        for (int i = 0; i < m; i++) weight[i] = freq[sym[i]];
+
+        int leaf = 0, node = m;
+        for (int k = m; k < 2 * m - 1; k++) {
+            int pick[2];
+            for (int t = 0; t < 2; t++) {
+                if (leaf < m && (node >= k || weight[leaf] <= weight[node]))
+                    pick[t] = leaf++;
+                else
+                    pick[t] = node++;
+            }
+            weight[k] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = k;
+        }
+
+        int max = 0;
+        depth[2 * m - 2] = 0;
+        for (int k = 2 * m - 3; k >= 0; k--) {
+            depth[k] = depth[parent[k]] + 1;
+            if (k < m && depth[k] > max) max = depth[k];
+        }
+        if (max <= limit) {
+            for (int i = 0; i < m; i++) len[sym[i]] = (uint8_t)depth[i];
+            return;
+        }
+        for (int i = 0; i < n; i++)
+            if (freq[i]) freq[i] = (freq[i] >> 1) | 1;
+    }
+}
+
+static void deflate_init(void)
+{
+    int code = 0;
+    for (int c = 0; c < 29; c++) {
+        int top = c < 28 ? len_base[c + 1] : MAX_MATCH + 1;
+        for (int l = len_base[c]; l < top && l <= MAX_MATCH; l++)
+            len_code[l] = (uint8_t)c;
+    }
+    len_code[MAX_MATCH] = 28;
+
+    for (code = 0; code < 30; code++) {
+        int top = code < 29 ? dist_base[code + 1] : 32769;
+        for (int d = dist_base[code]; d < top; d++) {
+            if (d <= 256) dist_code_lo[d - 1] = (uint8_t)code;
+            else          dist_code_hi[(d - 1) >> 7] = (uint8_t)code;
+        }
+    }
+
+    for (int i = 0; i < 288; i++)
+        fixed_lit.len[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    huff_codes(&fixed_lit, 288);
+    for (int i = 0; i < 30; i++)
+        fixed_dist.len[i] = 5;
+    huff_codes(&fixed_dist, 30);
+}
+
+static inline int dist_code(int d)
+{
+    return d <= 256 ? dist_code_lo[d - 1] : dist_code_hi[(d - 1) >> 7];
+}
+
+/* Token: literal (dist == 0) or match; packed as dist << 16 | lit/len */
+#define TOKEN(dist, v)   (((uint32_t)(dist) << 16) | (uint32_t)(v))
+#define TOKEN_DIST(t)    ((int)((t) >> 16))
+#define TOKEN_VALUE(t)   ((int)((t) & 0xffff))
+
+static void put_tokens(BitWriter* w, const uint32_t* tok, int n,
+                       const HuffCode* lit, const HuffCode* dist)
+{
+    for (int i = 0; i < n; i++) {
+        int d = TOKEN_DIST(tok[i]), v = TOKEN_VALUE(tok[i]);
+        if (d == 0) {
+            bw_put(w, lit->code[v], lit->len[v]);
+            continue;
+        }
+        int lc = len_code[v], dc = dist_code(d);
+        bw_put(w, lit->code[257 + lc], lit->len[257 + lc]);
+        bw_put(w, (uint32_t)(v - len_base[lc]), len_extra[lc]);
+        bw_put(w, dist->code[dc], dist->len[dc]);
+        bw_put(w, (uint32_t)(d - dist_base[dc]), dist_extra[dc]);
+    }
+    bw_put(w, lit->code[256], lit->len[256]);
+}
+
+static void put_stored(BitWriter* w, const uint8_t* data, size_t n, int final)
+{
+    do {
+        size_t part = n < 65535 ? n : 65535;
+        n -= part;
+        bw_put(w, (final && n == 0) ? 1u : 0u, 1);
+        bw_put(w, 0, 2);
+        bw_align(w);
+        bw_reserve(w, 4 + part);
+        if (w->oom) return;
+        w->buf[w->len++] = (uint8_t)(part & 0xff);
+        w->buf[w->len++] = (uint8_t)(part >> 8);
+        w->buf[w->len++] = (uint8_t)(~part & 0xff);
+        w->buf[w->len++] = (uint8_t)((~part >> 8) & 0xff);
+        memcpy(w->buf + w->len, data, part);
+        w->len += part;
+        data   += part;
+    } while (n > 0);
+}
+
+/* Run-length coded code lengths (symbols 0..18) for a dynamic header */
+static int rle_lengths(const uint8_t* lens, int n, uint8_t* sym, uint8_t* extra)
+{
+    int out = 0;
+    for (int i = 0; i < n;) {
+        int cur = lens[i], run = 1;
+        while (i + run < n && lens[i + run] == cur) run++;
+        i += run;
+        if (cur == 0) {
+            while (run >= 11) {
+                int r = run < 138 ? run : 138;
+                sym[out] = 18; extra[out++] = (uint8_t)(r - 11); run -= r;
+            }
+            if (run >= 3) {
+                sym[out] = 17; extra[out++] = (uint8_t)(run - 3); run = 0;
+            }
+        } else {
+            sym[out] = (uint8_t)cur; extra[out++] = 0; run--;
+            while (run >= 3) {
+                int r = run < 6 ? run : 6;
+                sym[out] = 16; extra[out++] = (uint8_t)(r - 3); run -= r;
+            }
+        }
+        while (run-- > 0) {
+            sym[out] = (uint8_t)cur; extra[out++] = 0;
+        }
+    }
+    return out;
+}
+
+/*
+ * Emit one block for tokens tok[0..n) covering raw[0..raw_len): the
+ * cheapest of stored, fixed and dynamic Huffman.
+ */
+static void put_block(BitWriter* w, const uint32_t* tok, int n,
+                      const uint8_t* raw, size_t raw_len, int final)
+{
+    uint32_t lf[286] = {0}, df[30] = {0};
+    uint64_t extra_bits = 0;
+    for (int i = 0; i < n; i++) {
+        int d = TOKEN_DIST(tok[i]), v = TOKEN_VALUE(tok[i]);
+        if (d == 0) { lf[v]++; continue; }
+        int lc = len_code[v], dc = dist_code(d);
+        lf[257 + lc]++;
+        df[dc]++;
+        extra_bits += len_extra[lc] + dist_extra[dc];
+    }
+    lf[256] = 1;
+
+    /* Fixed-code cost */
+    uint64_t fixed_bits = 3 + extra_bits;
+    for (int i = 0; i < 286; i++) fixed_bits += (uint64_t)lf[i] * fixed_lit.len[i];
+    for (int i = 0; i < 30; i++)  fixed_bits += (uint64_t)df[i] * 5;
+
+    /* Dynamic code: keep both trees complete (>= 2 symbols) */
+    HuffCode lit, dist;
+    memset(&lit, 0, sizeof(lit));
+    memset(&dist, 0, sizeof(dist));
+    if (lf[0] == 0) lf[0] = 1;
+    int used_d = 0;
+    for (int i = 0; i < 30; i++) used_d += df[i] != 0;
+    if (used_d < 2) { if (!df[0]) df[0] = 1; else df[1] = 1; }
+
+    huff_lengths(lf, 286, 15, lit.len);
+    huff_lengths(df, 30, 15, dist.len);
+    huff_codes(&lit, 286);
+    huff_codes(&dist, 30);
+
+    int nlit = 286, ndist = 30;
+    while (nlit > 257 && lit.len[nlit - 1] == 0) nlit--;
+    while (ndist > 1 && dist.len[ndist - 1] == 0) ndist--;
+
+    uint8_t all[286 + 30], sym[286 + 30], sym_extra[286 + 30];
+    memcpy(all, lit.len, (size_t)nlit);
+    memcpy(all + nlit, dist.len, (size_t)ndist);
+    int n_sym = rle_lengths(all, nlit + ndist, sym, sym_extra);
+
+    uint32_t cf[19] = {0};
+    for (int i = 0; i < n_sym; i++) cf[sym[i]]++;
+    HuffCode cl;
+    memset(&cl, 0, sizeof(cl));
+    huff_lengths(cf, 19, 7, cl.len);
+    huff_codes(&cl, 19);
+    int nclen = 19;
+    while (nclen > 4 && cl.len[clen_order[nclen - 1]] == 0) nclen--;
+
+    uint64_t dyn_bits = 3 + 14 + 3 * (uint64_t)nclen + extra_bits;
+    for (int i = 0; i < n_sym; i++) {
+        dyn_bits += cl.len[sym[i]];
+        dyn_bits += sym[i] == 16 ? 2 : sym[i] == 17 ? 3 : sym[i] == 18 ? 7 : 0;
+    }
+    for (int i = 0; i < 286; i++) dyn_bits += (uint64_t)lf[i] * lit.len[i];
+    for (int i = 0; i < 30; i++)  dyn_bits += (uint64_t)df[i] * dist.len[i];
+
+    uint64_t stored_bits = (raw_len + 5 * (raw_len / 65535 + 1)) * 8 + 8;
+
+    if (stored_bits <= fixed_bits && stored_bits <= dyn_bits) {
+        put_stored(w, raw, raw_len, final);
+    } else if (fixed_bits <= dyn_bits) {
+        bw_put(w, (uint32_t)final, 1);
+        bw_put(w, 1, 2);
+        put_tokens(w, tok, n, &fixed_lit, &fixed_dist);
+    } else {
+        bw_put(w, (uint32_t)final, 1);
+        bw_put(w, 2, 2);
+        bw_put(w, (uint32_t)(nlit - 257), 5);
+        bw_put(w, (uint32_t)(ndist - 1), 5);
+        bw_put(w, (uint32_t)(nclen - 4), 4);
+        for (int i = 0; i < nclen; i++)
+            bw_put(w, cl.len[clen_order[i]], 3);
+        for (int i = 0; i < n_sym; i++) {
+            bw_put(w, cl.code[sym[i]], cl.len[sym[i]]);
+            if (sym[i] == 16) bw_put(w, sym_extra[i], 2);
+            if (sym[i] == 17) bw_put(w, sym_extra[i], 3);
+            if (sym[i] == 18) bw_put(w, sym_extra[i], 7);
+        }
+        put_tokens(w, tok, n, &lit, &dist);
+    }
+}
+
+/* Per-thread match finder state */
+typedef struct {
+    int32_t  head[HASH_SIZE];
+    int32_t  prev[WINDOW_SIZE];
+    uint32_t tok[BLOCK_TOKENS];
+} Deflater;
+
+static inline uint32_t hash3(const uint8_t* p)
+{
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static inline void insert(Deflater* z, const uint8_t* data, int pos)
+{
+    uint32_t h = hash3(data + pos);
+    z->prev[pos & WINDOW_MASK] = z->head[h];
+    z->head[h] = pos;
+}
+
+static inline int match_length(const uint8_t* a, const uint8_t* b, int max)
+{
+    int n = 0;
+    while (n + 8 <= max) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y)
+            return n + (__builtin_ctzll(x ^ y) >> 3);
+        n += 8;
+    }
+    while (n < max && a[n] == b[n]) n++;
+    return n;
+}
+
+static int longest_match(const Deflater* z, const uint8_t* data, int pos,
+                         int max, int chain, int nice, int* dist)
+{
+    int best  = 0;
+    int limit = pos > WINDOW_SIZE ? pos - WINDOW_SIZE : 0;
+    int cand  = z->head[hash3(data + pos)];
+
+    while (cand >= limit && cand < pos && chain-- > 0) {
+        const uint8_t* c = data + cand;
+        if (c[best] == data[pos + best] && c[0] == data[pos]) {
+            int len = match_length(c, data + pos, max);
+            if (len > best) {
+                best  = len;
+                *dist = pos - cand;
+                if (len >= nice || len >= max) break;
+            }
+        }
+        int next = z->prev[cand & WINDOW_MASK];
+        if (next >= cand) break;
+        cand = next;
+    }
+    return best;
+}
+
+/*
+ * Compress data[begin, end) into w.  data[0, begin) is the preceding
+ * window (at most 32 KiB) and only primes the match finder.  Non-final
+ * chunks end with a sync flush so the next chunk starts byte-aligned.
+ */
+static void deflate_chunk(Deflater* z, BitWriter* w, const uint8_t* data,
+                          int begin, int end, int level, int final)
+{
+    if (level == 0) {
+        put_stored(w, data + begin, (size_t)(end - begin), final);
+        return;
+    }
+
+    int chain = level_params[level].chain;
+    int nice  = level_params[level].nice;
+    int lazy  = level_params[level].lazy;
+
+    for (int i = 0; i < HASH_SIZE; i++) z->head[i] = -1;
+    for (int p = 0; p + MIN_MATCH <= begin; p++)
+        insert(z, data, p);
+
+    int n_tok = 0, block_start = begin, pos = begin;
+    int have_next = 0, next_len = 0, next_dist = 0;
+
+    while (pos < end) {
+        int max = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+        int len = 0, dist = 0;
+
+        if (max >= MIN_MATCH) {
+            if (have_next) {
+                len  = next_len;
+                dist = next_dist;
+                have_next = 0;
+            } else {
+                len = longest_match(z, data, pos, max, chain, nice, &dist);
+            }
+            insert(z, data, pos);
+            if (len == MIN_MATCH && dist > TOO_FAR)
+                len = 0;
+
+            /* Lazy: prefer a longer match starting one byte later */
+            if (lazy && len >= MIN_MATCH && len < nice && pos + 1 + MIN_MATCH <= end) {
+                int max1 = end - pos - 1 < MAX_MATCH ? end - pos - 1 : MAX_MATCH;
+                int d1 = 0;
+                int l1 = longest_match(z, data, pos + 1, max1, chain, nice, &d1);
+                if (l1 > len) {
+                    have_next = 1;
+                    next_len  = l1;
+                    next_dist = d1;
+                    len = 0;
+                }
+            }
+        }
+
+        if (len >= MIN_MATCH) {
+            z->tok[n_tok++] = TOKEN(dist, len);
+            for (int p = pos + 1; p < pos + len && p + MIN_MATCH <= end; p++)
+                insert(z, data, p);
+            pos += len;
+        } else {
+            z->tok[n_tok++] = TOKEN(0, data[pos]);
+            pos++;
+        }
+
+        if (n_tok == BLOCK_TOKENS && pos < end) {
+            put_block(w, z->tok, n_tok, data + block_start,
+                      (size_t)(pos - block_start), 0);
+            n_tok = 0;
+            block_start = pos;
+        }
+    }
+    put_block(w, z->tok, n_tok, data + block_start,
+              (size_t)(end - block_start), final);
+}
+
+/* ======================================================================
+ * PNG container
+ * ====================================================================== */
+
+static void put_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);  p[3] = (uint8_t)v;
+}
+
+/* Write one chunk; `crc` is the CRC of type+data when known, else 0 */
+static int write_chunk(FILE* f, const char* type, const uint8_t* data,
+                       size_t n, int have_crc, uint32_t crc)
+{
+    uint8_t hdr[8], tail[4];
+    put_be32(hdr, (uint32_t)n);
+    memcpy(hdr + 4, type, 4);
+    if (!have_crc)
+        crc = crc_update(crc_update(0xffffffffu, (const uint8_t*)type, 4),
+                         data, n) ^ 0xffffffffu;
+    put_be32(tail, crc);
+    return fwrite(hdr, 1, 8, f) == 8
+        && (n == 0 || fwrite(data, 1, n, f) == n)
+        && fwrite(tail, 1, 4, f) == 4 ? 0 : -1;
+}
+
+typedef struct {
+    BitWriter out;
+    uint32_t  adler;
+    uint32_t  crc;      /* CRC of "IDAT" + out.buf */
+} ChunkResult;
+
+int png_write(const char* path, const Image* img, int level, int num_threads)
+{
+    static const int color_type[5] = { 0, 0, 4, 2, 6 };
+    if (img->channels < 1 || img->channels > 4 || img->width <= 0
+        || img->height <= 0) {
+        fprintf(stderr, "[png] Unsupported image layout\n");
+        return -1;
+    }
+    if (level < PNG_LEVEL_MIN) level = PNG_LEVEL_MIN;
+    if (level > PNG_LEVEL_MAX) level = PNG_LEVEL_MAX;
+    int nt = num_threads > 0 ? num_threads : omp_get_max_threads();
+
+    #pragma omp critical(png_tables)
+    {
+        if (crc_table[1] == 0) {
+            crc_init();
+            deflate_init();
+        }
+    }
+
+    size_t row   = (size_t)img->width * img->channels + 1;
+    size_t total = row * (size_t)img->height;
+    uint8_t* filtered = (uint8_t*)malloc(total);
+    if (!filtered || filter_image(filtered, img, level, nt) != 0) {
+        fprintf(stderr, "[png] Out of memory\n");
+        free(filtered);
+        return -1;
+    }
+
+    int n_chunks = (int)((total + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    ChunkResult* res = (ChunkResult*)calloc((size_t)n_chunks, sizeof(ChunkResult));
+    int failed = res == NULL;
+
+    if (!failed) {
+        #pragma omp parallel num_threads(nt) reduction(|:failed)
+        {
+            Deflater* z = level > 0 ? (Deflater*)malloc(sizeof(Deflater)) : NULL;
+            if (level > 0 && !z)
+                failed = 1;
+
+            #pragma omp for schedule(dynamic, 1)
+            for (int c = 0; c < n_chunks; c++) {
+                if (level > 0 && !z) continue;
+                size_t begin = (size_t)c * CHUNK_SIZE;
+                size_t end   = begin + CHUNK_SIZE < total ? begin + CHUNK_SIZE : total;
+                size_t dict  = begin < WINDOW_SIZE ? begin : WINDOW_SIZE;
+                const uint8_t* base = filtered + begin - dict;
+
+                ChunkResult* r = &res[c];
+                deflate_chunk(z, &r->out, base, (int)dict, (int)(dict + end - begin),
+                              level, c == n_chunks - 1);
+                if (c < n_chunks - 1) {
+                    /* sync flush: empty non-final stored block */
+                    bw_put(&r->out, 0, 3);
+                    bw_align(&r->out);
+                    bw_reserve(&r->out, 4);
+                    if (!r->out.oom) {
+                        memcpy(r->out.buf + r->out.len, "\x00\x00\xff\xff", 4);
+                        r->out.len += 4;
+                    }
+                } else {
+                    bw_align(&r->out);
+                }
+                if (r->out.oom) { failed = 1; continue; }
+                r->adler = adler32(filtered + begin, end - begin);
+                r->crc   = crc_update(crc_update(0xffffffffu,
+                                                 (const uint8_t*)"IDAT", 4),
+                                      r->out.buf, r->out.len) ^ 0xffffffffu;
+            }
+            free(z);
+        }
+    }
+
+    FILE* f = failed ? NULL : fopen(path, "wb");
+    int ret = -1;
+    if (f) {
+        static const uint8_t sig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+        uint8_t ihdr[13];
+        put_be32(ihdr, (uint32_t)img->width);
+        put_be32(ihdr + 4, (uint32_t)img->height);
+        ihdr[8]  = 8;
+        ihdr[9]  = (uint8_t)color_type[img->channels];
+        ihdr[10] = 0; ihdr[11] = 0; ihdr[12] = 0;
+
+        /* zlib header: deflate, 32K window, FLEVEL from the level */
+        int flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        uint8_t zhdr[2] = { 0x78, (uint8_t)(flevel << 6) };
+        zhdr[1] = (uint8_t)(zhdr[1] + 31 - (0x78 * 256 + zhdr[1]) % 31);
+
+        uint32_t adler = res[0].adler;
+        for (int c = 1; c < n_chunks; c++) {
+            size_t begin = (size_t)c * CHUNK_SIZE;
+            size_t len   = begin + CHUNK_SIZE < total ? CHUNK_SIZE : total - begin;
+            adler = adler32_combine(adler, res[c].adler, len);
+        }
+        uint8_t ztail[4];
+        put_be32(ztail, adler);
+
+        ret = fwrite(sig, 1, 8, f) == 8 ? 0 : -1;
+        if (ret == 0) ret = write_chunk(f, "IHDR", ihdr, 13, 0, 0);
+        if (ret == 0) ret = write_chunk(f, "IDAT", zhdr, 2, 0, 0);
+        for (int c = 0; c < n_chunks && ret == 0; c++)
+            ret = write_chunk(f, "IDAT", res[c].out.buf, res[c].out.len,
+                              1, res[c].crc);
+        if (ret == 0) ret = write_chunk(f, "IDAT", ztail, 4, 0, 0);
+        if (ret == 0) ret = write_chunk(f, "IEND", NULL, 0, 0, 0);
+        if (fclose(f) != 0) ret = -1;
+        if (ret != 0)
+            fprintf(stderr, "[png] Write error for '%s'\n", path);
+    } else if (failed) {
+        fprintf(stderr, "[png] Out of memory\n");
+    } else {
+        fprintf(stderr, "[png] Cannot open '%s' for writing\n", path);
+    }
+
+    if (res)
+        for (int c = 0; c < n_chunks; c++)
+            free(res[c].out.buf);
+    free(res);
+    free(filtered);
+    return ret;
+}
@@ -0,0 +1,302 @@
+#include "common/qoi.h"
+#include "common/pixel_buffer.h"
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00   /* 00xxxxxx */
+#define QOI_OP_DIFF  0x40   /* 01xxxxxx */
+#define QOI_OP_LUMA  0x80   /* 10xxxxxx */
+#define QOI_OP_RUN   0xc0   /* 11xxxxxx */
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN     62
+
+static const uint8_t qoi_padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+typedef union {
+    struct { uint8_t r, g, b, a; } rgba;
+    uint32_t v;
+} QoiPixel;
+
+static inline int qoi_hash(QoiPixel p)
+{
+    return (p.rgba.r * 3 + p.rgba.g * 5 + p.rgba.b * 7 + p.rgba.a * 11) & 63;
+}
+
+static inline QoiPixel read_px(const uint8_t* src, int channels)
+{
+    QoiPixel p;
+    p.rgba.r = src[0];
+    p.rgba.g = src[1];
+    p.rgba.b = src[2];
+    p.rgba.a = channels == 4 ? src[3] : 255;
+    return p;
+}
+
+static void put_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);  p[3] = (uint8_t)v;
+}
+
+static uint32_t be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+         | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Encode pixels [begin, end) into out, starting from `prev` (the pixel
+ * before begin, or the QOI initial {0,0,0,255}).  The colour cache
+ * starts empty and a slot is only referenced once this strip has
+ * written it, which keeps the output valid after any earlier strip.
+ * Returns the number of bytes written.
+ */
+static size_t encode_strip(uint8_t* out, const uint8_t* pixels, int channels,
+                           size_t begin, size_t end, QoiPixel prev)
+{
+    QoiPixel index[64];
+    uint64_t valid = 0;
+    size_t   n = 0;
+    int      run = 0;
+
+    for (size_t i = begin; i < end; i++) {
+        QoiPixel px = read_px(pixels + i * channels, channels);
+
+        if (px.v == prev.v) {
+            if (++run == QOI_MAX_RUN) {
+                out[n++] = (uint8_t)(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out[n++] = (uint8_t)(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        int h = qoi_hash(px);
+        if ((valid >> h & 1) && index[h].v == px.v) {
+            out[n++] = (uint8_t)(QOI_OP_INDEX | h);
+        } else {
+            index[h] = px;
+            valid   |= 1ull << h;
+
+            if (px.rgba.a == prev.rgba.a) {
+                int8_t vr = (int8_t)(px.rgba.r - prev.rgba.r);
+                int8_t vg = (int8_t)(px.rgba.g - prev.rgba.g);
+                int8_t vb = (int8_t)(px.rgba.b - prev.rgba.b);
+                int8_t vg_r = (int8_t)(vr - vg);
+                int8_t vg_b = (int8_t)(vb - vg);
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    out[n++] = (uint8_t)(QOI_OP_DIFF | (vr + 2) << 4
+                                         | (vg + 2) << 2 | (vb + 2));
+                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32
+                           && vg_b > -9 && vg_b < 8) {
+                    out[n++] = (uint8_t)(QOI_OP_LUMA | (vg + 32));
+                    out[n++] = (uint8_t)((vg_r + 8) << 4 | (vg_b + 8));
+                } else {
+                    out[n++] = QOI_OP_RGB;
+                    out[n++] = px.rgba.r;
+                    out[n++] = px.rgba.g;
+                    out[n++] = px.rgba.b;
+                }
+            } else {
+                out[n++] = QOI_OP_RGBA;
+                out[n++] = px.rgba.r;
+                out[n++] = px.rgba.g;
+                out[n++] = px.rgba.b;
+                out[n++] = px.rgba.a;
+            }
+        }
+        prev = px;
+    }
+    if (run > 0)
+        out[n++] = (uint8_t)(QOI_OP_RUN | (run - 1));
+    return n;
+}
+
+int qoi_save(const char* path, const Image* img, int num_threads)
+{
+    if ((img->channels != 3 && img->channels != 4)
+        || img->width <= 0 || img->height <= 0) {
+        fprintf(stderr, "[qoi] Unsupported image layout\n");
+        return -1;
+    }
+    int    ch     = img->channels;
+    size_t total  = (size_t)img->width * img->height;
+    int    strips = (int)((total + QOI_STRIP_PIXELS - 1) / QOI_STRIP_PIXELS);
+    int    nt     = num_threads > 0 ? num_threads : omp_get_max_threads();
+
+    /* worst case per pixel: an RGBA op (5 bytes) */
+    uint8_t** out = (uint8_t**)calloc((size_t)strips, sizeof(uint8_t*));
+    size_t*   len = (size_t*)calloc((size_t)strips, sizeof(size_t));
+    int failed = !out || !len;
+
+    if (!failed) {
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(nt) reduction(|:failed)
+        for (int s = 0; s < strips; s++) {
+            size_t begin = (size_t)s * QOI_STRIP_PIXELS;
+            size_t end   = begin + QOI_STRIP_PIXELS < total
+                         ? begin + QOI_STRIP_PIXELS : total;
+            QoiPixel prev;
+            prev.v = 0;
+            prev.rgba.a = 255;
+            if (begin > 0)
+                prev = read_px(img->pixels + (begin - 1) * ch, ch);
+
+            out[s] = (uint8_t*)malloc((end - begin) * 5);
+            if (!out[s]) {
+                failed = 1;
+                continue;
+            }
+            len[s] = encode_strip(out[s], img->pixels, ch, begin, end, prev);
+        }
+    }
+
+    int ret = -1;
+    FILE* f = failed ? NULL : fopen(path, "wb");
+    if (f) {
+        uint8_t hdr[QOI_HEADER_SIZE];
+        memcpy(hdr, "qoif", 4);
+        put_be32(hdr + 4, (uint32_t)img->width);
+        put_be32(hdr + 8, (uint32_t)img->height);
+        hdr[12] = (uint8_t)ch;
+        hdr[13] = 0;                    /* sRGB with linear alpha */
+
+        ret = fwrite(hdr, 1, sizeof(hdr), f) == sizeof(hdr) ? 0 : -1;
+        for (int s = 0; s < strips && ret == 0; s++)
+            if (fwrite(out[s], 1, len[s], f) != len[s])
+                ret = -1;
+        if (ret == 0 && fwrite(qoi_padding, 1, 8, f) != 8)
+            ret = -1;
+        if (fclose(f) != 0)
+            ret = -1;
+        if (ret != 0)
+            fprintf(stderr, "[qoi] Write error for '%s'\n", path);
+    } else if (failed) {
+        fprintf(stderr, "[qoi] Out of memory\n");
+    } else {
+        fprintf(stderr, "[qoi] Cannot open '%s' for writing\n", path);
+    }
+
+    if (out)
+        for (int s = 0; s < strips; s++)
+            free(out[s]);
+    free(out);
+    free(len);
+    return ret;
+}
+
+int qoi_load(const char* path, Image* img)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "[qoi] Cannot open '%s'\n", path);
+        return -1;
+    }
+    uint8_t* data = NULL;
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= QOI_HEADER_SIZE + 8
+        && fseek(f, 0, SEEK_SET) == 0) {
+        data = (uint8_t*)malloc((size_t)size);
+        if (data && fread(data, 1, (size_t)size, f) != (size_t)size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(f);
+    if (!data) {
+        fprintf(stderr, "[qoi] Cannot read '%s'\n", path);
+        return -1;
+    }
+
+    uint32_t w = be32(data + 4), h = be32(data + 8);
+    int ch = data[12];
+    if (memcmp(data, "qoif", 4) != 0 || w == 0 || h == 0
+        || w > 0x7fffffffu || h > 0x7fffffffu
+        || (ch != 3 && ch != 4) || (uint64_t)w * h > (uint64_t)SIZE_MAX / 3) {
+        fprintf(stderr, "[qoi] Bad header in '%s'\n", path);
+        free(data);
+        return -1;
+    }
+
+    size_t   total  = (size_t)w * h;
+    uint8_t* pixels = pixel_alloc(total * 3);
+    if (!pixels) {
+        free(data);
+        return -1;
+    }
+    /* decoding is serial: place the pages first, as image_alloc does */
+    pixel_first_touch(pixels, total * 3);
+
+    QoiPixel index[64], px;
+    memset(index, 0, sizeof(index));
+    px.v = 0;
+    px.rgba.a = 255;
+
+    const uint8_t* p   = data + QOI_HEADER_SIZE;
+    const uint8_t* end = data + size - 8;
+    uint8_t*       dst = pixels;
+    size_t i = 0;
+
+    while (i < total && p < end) {
+        int b1 = *p++;
+        int run = 1;
+
+        if (b1 == QOI_OP_RGB) {
+            if (end - p < 3) break;
+            px.rgba.r = p[0]; px.rgba.g = p[1]; px.rgba.b = p[2];
+            p += 3;
+        } else if (b1 == QOI_OP_RGBA) {
+            if (end - p < 4) break;
+            px.rgba.r = p[0]; px.rgba.g = p[1]; px.rgba.b = p[2]; px.rgba.a = p[3];
+            p += 4;
+        } else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+            px = index[b1];
+        } else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+            px.rgba.r = (uint8_t)(px.rgba.r + ((b1 >> 4) & 3) - 2);
+            px.rgba.g = (uint8_t)(px.rgba.g + ((b1 >> 2) & 3) - 2);
+            px.rgba.b = (uint8_t)(px.rgba.b + (b1 & 3) - 2);
+        } else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+            int b2 = *p++;
+            int vg = (b1 & 0x3f) - 32;
+            px.rgba.r = (uint8_t)(px.rgba.r + vg - 8 + ((b2 >> 4) & 0x0f));
+            px.rgba.g = (uint8_t)(px.rgba.g + vg);
+            px.rgba.b = (uint8_t)(px.rgba.b + vg - 8 + (b2 & 0x0f));
+        } else {
+            run = (b1 & 0x3f) + 1;
+            if ((size_t)run > total - i)
+                run = (int)(total - i);
+        }
+        /* Like the reference decoder: after every op, runs included */
+        index[qoi_hash(px)] = px;
+
+        for (int r = 0; r < run; r++) {
+            dst[0] = px.rgba.r;
+            dst[1] = px.rgba.g;
+            dst[2] = px.rgba.b;
+            dst += 3;
+        }
+        i += (size_t)run;
+    }
+    free(data);
+
+    if (i < total) {
+        fprintf(stderr, "[qoi] Truncated data in '%s'\n", path);
+        pixel_free(pixels, total * 3);
+        return -1;
+    }
+    img->pixels   = pixels;
+    img->width    = (int)w;
+    img->height   = (int)h;
+    img->channels = 3;
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "common/stego_engine.h"
+#include "opencl/stego_opencl.h"
+#include "openmp/stego_openmp.h"
+#include "openmp/stego_kernels.h"
+#include "common/stego_utils.h"
+
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+int stego_engine_init(StegoEngine* eng, int num_threads, int use_ocl)
+{
+    memset(eng, 0, sizeof(*eng));
+    eng->num_threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+    eng->use_ocl     = use_ocl;
+
+    /* Fill the CPU dispatch table now, not lazily inside concurrent calls */
+    (void)stego_kernels();
+
+    if (use_ocl && cl_init(&eng->cl) != 0)
+        return -1;
+    return 0;
+}
+
+int stego_engine_init_auto(StegoEngine* eng, const AutotuneModel* model)
+{
+    if (stego_engine_init(eng, 0, autotune_has_ocl(model)) != 0)
+        return -1;
+    eng->model = model;
+    return 0;
+}
+
+/* Resolve the configuration for one call of `op` moving `bytes` at k */
+static void engine_plan(StegoEngine* eng, AutotuneOp op, int bits,
+                        size_t bytes)
+{
+    const AutotuneConfig* cfg = eng->model
+        ? autotune_pick(eng->model, op, bits, eng->keyed, bytes) : NULL;
+
+    if (cfg) {
+        eng->last_ocl     = cfg->use_ocl;
+        eng->last_threads = cfg->use_ocl ? 0 : cfg->threads;
+    } else {
+        eng->last_ocl     = eng->use_ocl;
+        eng->last_threads = eng->use_ocl ? 0 : eng->num_threads;
+    }
+}
+
+int stego_engine_set_key(StegoEngine* eng, const char* passphrase)
+{
+    eng->keyed = 0;
+    if (!passphrase || !*passphrase)
+        return 0;
+    if (stego_key_derive(&eng->key, passphrase) != 0)
+        return -1;
+    eng->keyed = 1;
+    return 0;
+}
+
+void stego_engine_destroy(StegoEngine* eng)
+{
+    if (eng->use_ocl)
+        cl_cleanup(&eng->cl);
+    free(eng->scratch);
+    eng->scratch     = NULL;
+    eng->scratch_cap = 0;
+}
+
+int stego_engine_encode(StegoEngine* eng, Image* img, const StegoMessage* msg,
+                        int bits)
+{
+    StegoSegment    body = { msg->data, msg->length };
+    const StegoKey* key  = eng->keyed ? &eng->key : NULL;
+
+    /* Sequential frames touch a prefix; keyed ones the whole raster */
+    eng->dirty_begin = 0;
+    eng->dirty_end   = key ? (size_t)img->width * img->height * img->channels
+                           : stego_carrier_bytes(msg->length, bits);
+
+    engine_plan(eng, AUTOTUNE_ENCODE, bits, msg->length);
+    if (eng->last_ocl)
+        return stego_encode_ocl_keyed(&eng->cl, img, &body, 1, bits, key);
+    return stego_encode_omp_keyed(img, &body, 1, bits, key, eng->last_threads);
+}
+
+int stego_engine_decode(StegoEngine* eng, const Image* img,
+                        const uint8_t** data, size_t* length)
+{
+    int ret;
+    size_t bytes = 0;
+    int    bits  = 1;
+
+    if (eng->model) {
+        /* Peek the 32-carrier header so the plan matches the payload */
+        uint8_t header[4];
+        if ((size_t)img->width * img->height * img->channels < STEGO_HEADER_CARRIER)
+            return -1;
+        stego_kernels()->decode(header, img->pixels, sizeof(header));
+        if (stego_header_decode(header, &bytes, &bits) != 0)
+            return -1;
+    }
+    engine_plan(eng, AUTOTUNE_DECODE, bits, bytes);
+
+    const StegoKey* key = eng->keyed ? &eng->key : NULL;
+    if (eng->last_ocl)
+        ret = stego_decode_ocl_keyed_into(&eng->cl, img, key, &eng->scratch,
+                                          &eng->scratch_cap, length);
+    else
+        ret = stego_decode_omp_keyed_into(img, key, &eng->scratch,
+                                          &eng->scratch_cap, length,
+                                          eng->last_threads);
+    if (ret != 0)
+        return -1;
+
+    *data = eng->scratch;
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include "common/stego_scatter.h"
+
+#include <string.h>
+
+/* splitmix64 step: spreads the passphrase hash over the round keys */
+static uint64_t splitmix64(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+int stego_key_derive(StegoKey* key, const char* passphrase)
+{
+    if (!passphrase || !*passphrase)
+        return -1;
+
+    /* FNV-1a over the passphrase */
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const unsigned char* p = (const unsigned char*)passphrase; *p; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ull;
+    }
+
+    for (int i = 0; i < STEGO_SCATTER_ROUNDS; i += 2) {
+        uint64_t v = splitmix64(&h);
+        key->round[i]     = (uint32_t)v;
+        key->round[i + 1] = (uint32_t)(v >> 32);
+    }
+    return 0;
+}
+
+void stego_scatter_init(StegoScatter* s, const StegoKey* key, uint64_t domain)
+{
+    /* Smallest 2*half >= bit width of domain - 1 (half >= 1) */
+    unsigned width = 0;
+    for (uint64_t v = domain > 1 ? domain - 1 : 1; v; v >>= 1)
+        width++;
+
+    s->domain = domain;
+    s->half   = (width + 1) / 2;
+    s->mask   = s->half >= 32 ? 0xffffffffu : (1u << s->half) - 1;
+    memcpy(s->round, key->round, sizeof(s->round));
+}
@@ -0,0 +1,247 @@
+#include "common/stego_stream.h"
+#include "common/filesystem_utils.h"
+#include "common/image_io.h"
+#include "common/stego_utils.h"
+#include "openmp/stego_kernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#  include <sys/stat.h>
+#endif
+
+typedef struct {
+    uint8_t* buf;
+    size_t   len;
+} StripSlot;
+
+/*
+ * Strip size in bytes: whole rows, a multiple of 8 carrier bytes (one
+ * k-LSB group, so kernels never split a group) and at least the header.
+ */
+static size_t strip_size(int width, size_t strip_bytes)
+{
+    size_t row  = (size_t)width * 3;
+    size_t step = 8;                    /* rows per 8-byte alignment */
+    while (step > 1 && (row * (step / 2)) % 8 == 0)
+        step /= 2;
+
+    if (strip_bytes == 0)
+        strip_bytes = STREAM_STRIP_DEFAULT;
+    size_t rows = strip_bytes / row / step * step;
+    if (rows == 0)
+        rows = step;
+    while (rows * row < STEGO_HEADER_CARRIER)
+        rows += step;
+    return rows * row;
+}
+
+/*
+ * Payload bytes [*p0, *p1) whose carriers lie in the strip starting at
+ * carrier `start` with `len` bytes.  Returns 0 if the strip holds none.
+ */
+static int strip_payload(size_t start, size_t len, size_t length, int bits,
+                         size_t* p0, size_t* p1)
+{
+    size_t end   = start + len;
+    size_t first = start > STEGO_HEADER_CARRIER ? start : STEGO_HEADER_CARRIER;
+    if (end <= first)
+        return 0;
+    *p0 = (first - STEGO_HEADER_CARRIER) / 8 * (size_t)bits;
+    *p1 = (end - STEGO_HEADER_CARRIER) / 8 * (size_t)bits;
+    if ((end - STEGO_HEADER_CARRIER) % 8)
+        *p1 = length;                   /* raster end: only the last strip */
+    if (*p1 > length)
+        *p1 = length;
+    return *p0 < *p1;
+}
+
+static inline size_t payload_carrier(size_t byte, int bits)
+{
+    return STEGO_HEADER_CARRIER + byte / (size_t)bits * 8;
+}
+
+#if !defined(_WIN32)
+static int same_file(const char* a, const char* b)
+{
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0
+        && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+#else
+static int same_file(const char* a, const char* b)
+{
+    return strcmp(a, b) == 0;
+}
+#endif
+
+int stego_stream_encode(const char* in, const char* out,
+                        const StegoMessage* msg, int bits, size_t strip_bytes)
+{
+    StegoSegment body = { msg->data, msg->length };
+    StegoPayload payload;
+    if (stego_payload_init(&payload, &body, 1, bits) != 0)
+        return -1;
+    if (same_file(in, out)) {
+        fprintf(stderr, "[stream] Output must be a different file than '%s'\n", in);
+        return -1;
+    }
+
+    int w, h;
+    FILE* src = image_open_ppm(in, &w, &h);
+    if (!src)
+        return -1;
+
+    size_t total     = (size_t)w * h * 3;
+    size_t n_carrier = stego_carrier_bytes(msg->length, bits);
+    if (n_carrier > total) {
+        fprintf(stderr, "[stream] Message too large: needs %zu carrier bytes, "
+                        "image has %zu\n", n_carrier, total);
+        fclose(src);
+        return -1;
+    }
+
+    FILE* dst = NULL;
+    if (create_output_directories(out) == 0)
+        dst = fopen(out, "wb");
+    if (!dst) {
+        fprintf(stderr, "[stream] Cannot open '%s' for writing\n", out);
+        fclose(src);
+        return -1;
+    }
+    fprintf(dst, "P6\n%d %d\n255\n", w, h);
+
+    size_t    strip    = strip_size(w, strip_bytes);
+    size_t    n_strips = (total + strip - 1) / strip;
+    StripSlot ring[STREAM_RING];
+    int       failed   = 0;
+    for (int r = 0; r < STREAM_RING; r++) {
+        ring[r].buf = (uint8_t*)malloc(strip);
+        if (!ring[r].buf) failed = 1;
+    }
+
+    StegoEncodeFn encode = stego_encode_kernel(bits);
+    char rd_order, wr_order;            /* dependence tokens */
+
+    if (!failed) {
+        #pragma omp parallel num_threads(STREAM_RING)
+        #pragma omp single
+        for (size_t i = 0; i < n_strips; i++) {
+            StripSlot* slot  = &ring[i % STREAM_RING];
+            size_t     start = i * strip;
+            size_t     len   = total - start < strip ? total - start : strip;
+
+            #pragma omp task depend(inout: slot[0], rd_order) firstprivate(slot, len)
+            {
+                int bad;
+                #pragma omp atomic read
+                bad = failed;
+                slot->len = len;
+                if (!bad && fread(slot->buf, 1, len, src) != len) {
+                    #pragma omp atomic write
+                    failed = 1;
+                }
+            }
+
+            if (start < n_carrier) {
+                #pragma omp task depend(inout: slot[0]) firstprivate(slot, start, len)
+                {
+                    size_t p0, p1;
+                    if (start == 0)
+                        stego_kernels()->encode(slot->buf, payload.header, 4);
+                    if (strip_payload(start, len, msg->length, bits, &p0, &p1))
+                        encode(slot->buf + payload_carrier(p0, bits) - start,
+                               msg->data + p0, p1 - p0);
+                }
+            }
+
+            #pragma omp task depend(inout: slot[0], wr_order) firstprivate(slot)
+            {
+                int bad;
+                #pragma omp atomic read
+                bad = failed;
+                if (!bad && fwrite(slot->buf, 1, slot->len, dst) != slot->len) {
+                    #pragma omp atomic write
+                    failed = 1;
+                }
+            }
+        }
+    }
+    (void)rd_order; (void)wr_order;     /* unused without OpenMP */
+
+    for (int r = 0; r < STREAM_RING; r++)
+        free(ring[r].buf);
+    fclose(src);
+    if (fclose(dst) != 0)
+        failed = 1;
+    if (failed)
+        fprintf(stderr, "[stream] I/O error while streaming '%s' -> '%s'\n",
+                in, out);
+    return failed ? -1 : 0;
+}
+
+int stego_stream_decode(const char* in, StegoMessage* msg, size_t strip_bytes)
+{
+    int w, h;
+    FILE* src = image_open_ppm(in, &w, &h);
+    if (!src)
+        return -1;
+
+    size_t   total = (size_t)w * h * 3;
+    size_t   strip = strip_size(w, strip_bytes);
+    uint8_t* buf   = (uint8_t*)malloc(strip);
+    if (!buf || total < STEGO_HEADER_CARRIER) {
+        fprintf(stderr, "[stream] Cannot decode '%s'\n", in);
+        free(buf);
+        fclose(src);
+        return -1;
+    }
+
+    size_t length = 0, n_carrier = STEGO_HEADER_CARRIER;
+    int    bits   = 1;
+    msg->data   = NULL;
+    msg->length = 0;
+    StegoDecodeFn decode = NULL;
+    int ret = 0;
+
+    for (size_t start = 0; ret == 0 && start < n_carrier; start += strip) {
+        size_t len = total - start < strip ? total - start : strip;
+        if (fread(buf, 1, len, src) != len) {
+            fprintf(stderr, "[stream] Truncated pixel data in '%s'\n", in);
+            ret = -1;
+            break;
+        }
+
+        if (start == 0) {
+            uint8_t header[4];
+            stego_kernels()->decode(header, buf, 4);
+            if (stego_header_decode(header, &length, &bits) != 0
+                || (n_carrier = stego_carrier_bytes(length, bits)) > total) {
+                fprintf(stderr, "[stream] Invalid embedded length %zu at k=%d\n",
+                        length, bits);
+                ret = -1;
+                break;
+            }
+            msg->data = (uint8_t*)malloc(length);
+            if (!msg->data) {
+                ret = -1;
+                break;
+            }
+            msg->length = length;
+            decode = stego_decode_kernel(bits);
+        }
+
+        size_t p0, p1;
+        if (strip_payload(start, len, length, bits, &p0, &p1))
+            decode(msg->data + p0, buf + payload_carrier(p0, bits) - start,
+                   p1 - p0);
+    }
+
+    free(buf);
+    fclose(src);
+    if (ret != 0)
+        stego_message_free(msg);
+    return ret;
+}
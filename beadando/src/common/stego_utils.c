@@ -1,35 +1,150 @@
+#if !defined(_WIN32)
+#  define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "common/stego_utils.h"
+#include "common/file_io.h"
+#include "common/filesystem_utils.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-uint8_t* stego_frame(const StegoMessage* msg, size_t* framed_len)
+int stego_payload_init(StegoPayload* p, const StegoSegment* body, int n_body,
+                       int bits)
+{
+    if (n_body < 0 || n_body > STEGO_MAX_SEGMENTS) {
+        fprintf(stderr, "[stego] Too many payload segments (%d)\n", n_body);
+        return -1;
+    }
+    if (bits < STEGO_MIN_BITS || bits > STEGO_MAX_BITS) {
+        fprintf(stderr, "[stego] Bits per channel must be %d..%d, got %d\n",
+                STEGO_MIN_BITS, STEGO_MAX_BITS, bits);
+        return -1;
+    }
+
+    p->n_segs = 0;
+    p->length = 0;
+    p->bits   = bits;
+    for (int i = 0; i < n_body; i++) {
+        if (body[i].length == 0) continue;
+        p->segs[p->n_segs++] = body[i];
+        p->length += body[i].length;
+    }
+
+    if (p->length > STEGO_MAX_LENGTH) {
+        fprintf(stderr, "[stego] Payload of %zu bytes exceeds the %u-byte "
+                        "frame limit\n", p->length, STEGO_MAX_LENGTH);
+        return -1;
+    }
+
+    uint32_t word = (uint32_t)p->length | ((uint32_t)(bits - 1) << 30);
+    p->header[0] = (uint8_t)( word        & 0xFF);
+    p->header[1] = (uint8_t)((word >>  8) & 0xFF);
+    p->header[2] = (uint8_t)((word >> 16) & 0xFF);
+    p->header[3] = (uint8_t)((word >> 24) & 0xFF);
+    return 0;
+}
+
+const uint8_t* stego_payload_view(const StegoPayload* p, size_t begin,
+                                  size_t end, uint8_t* scratch)
+{
+    size_t seg_begin = 0;
+    size_t out       = 0;
+    for (int i = 0; i < p->n_segs && seg_begin < end; i++) {
+        size_t seg_end = seg_begin + p->segs[i].length;
+        size_t lo = begin > seg_begin ? begin : seg_begin;
+        size_t hi = end   < seg_end   ? end   : seg_end;
+        if (lo < hi) {
+            const uint8_t* src = p->segs[i].data + (lo - seg_begin);
+            if (lo == begin && hi == end)
+                return src;
+            memcpy(scratch + out, src, hi - lo);
+            out += hi - lo;
+        }
+        seg_begin = seg_end;
+    }
+    return scratch;
+}
+
+int stego_header_decode(const uint8_t header[4], size_t* length, int* bits)
 {
-    *framed_len = 4 + msg->length;
-    uint8_t* buf = (uint8_t*)malloc(*framed_len);
-    if (!buf) return NULL;
-
-    uint32_t len32 = (uint32_t)msg->length;
-    buf[0] = (uint8_t)( len32        & 0xFF);
-    buf[1] = (uint8_t)((len32 >>  8) & 0xFF);
-    buf[2] = (uint8_t)((len32 >> 16) & 0xFF);
-    buf[3] = (uint8_t)((len32 >> 24) & 0xFF);
-    memcpy(buf + 4, msg->data, msg->length);
-
-    return buf;
+    uint32_t word =  (uint32_t)header[0]
+                  | ((uint32_t)header[1] <<  8)
+                  | ((uint32_t)header[2] << 16)
+                  | ((uint32_t)header[3] << 24);
+
+    *length = (size_t)(word & STEGO_MAX_LENGTH);
+    *bits   = (int)(word >> 30) + 1;
+    return *length == 0 ? -1 : 0;
 }
 
-int stego_check_capacity(const Image* img, const StegoMessage* msg)
+int stego_check_capacity(const Image* img, size_t length, int bits)
 {
-    size_t bits_needed   = (4 + msg->length) * 8;
-    size_t carrier_bytes = (size_t)img->width * img->height * img->channels;
+    size_t carrier_needed = stego_carrier_bytes(length, bits);
+    size_t carrier_bytes  = (size_t)img->width * img->height * img->channels;
 
-    if (bits_needed > carrier_bytes) {
+    if (carrier_needed > carrier_bytes) {
         fprintf(stderr,
                 "[stego] Message too large: need %zu carrier bytes, have %zu\n",
-                bits_needed, carrier_bytes);
+                carrier_needed, carrier_bytes);
+        return -1;
+    }
+    return 0;
+}
+
+int stego_message_load(const char* path, StegoMessage* msg)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    rewind(f);
+
+    if (sz <= 0) {
+        fclose(f);
+        fprintf(stderr, "Empty message file\n");
+        return -1;
+    }
+
+    msg->length = (size_t)sz;
+    msg->data   = (uint8_t*)malloc((size_t)sz);
+    if (!msg->data) {
+        fclose(f);
+        return -1;
+    }
+
+    if (file_read_at(fileno(f), msg->data, (size_t)sz, 0) != 0) {
+        perror("read");
+        fclose(f);
+        free(msg->data);
         return -1;
     }
+    fclose(f);
     return 0;
-}
\ No newline at end of file
+}
+
+int stego_message_save(const char* path, const StegoMessage* msg)
+{
+    if (create_output_directories(path) != 0) {
+        fprintf(stderr, "Cannot create directory for '%s'\n", path);
+        return -1;
+    }
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    if (file_write_at(fileno(f), msg->data, msg->length, 0) != 0) {
+        perror("write");
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
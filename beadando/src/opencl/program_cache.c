@@ -0,0 +1,216 @@
+#if !defined(_WIN32)
+#  define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "opencl/program_cache.h"
+#include "common/filesystem_utils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#  include <fcntl.h>
+#  include <io.h>
+#  include <sys/stat.h>
+#else
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#define CACHE_MAGIC  "STEGOCLB"
+#define FNV_OFFSET   0xcbf29ce484222325ull
+#define FNV_PRIME    0x100000001b3ull
+
+typedef struct {
+    char     magic[8];
+    uint64_t key;
+    uint64_t size;          /* binary bytes that follow */
+    uint64_t checksum;      /* FNV-1a of the binary     */
+} CacheHeader;
+
+static const char* cache_dir = CL_CACHE_DIR_DEFAULT;
+
+void cl_set_cache_dir(const char* dir)
+{
+    cache_dir = (dir && dir[0] && strcmp(dir, "off") != 0) ? dir : NULL;
+}
+
+const char* cl_cache_dir(void)
+{
+    return cache_dir;
+}
+
+static uint64_t fnv1a(uint64_t h, const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/* Hash a string including its terminator, so fields cannot run together */
+static uint64_t fnv1a_str(uint64_t h, const char* s)
+{
+    return fnv1a(h, s, strlen(s) + 1);
+}
+
+static uint64_t cache_key(CLContext* ctx, const char* source,
+                          const char* build_options)
+{
+    static const cl_platform_info pinfo[] = {
+        CL_PLATFORM_NAME, CL_PLATFORM_VERSION
+    };
+    static const cl_device_info dinfo[] = {
+        CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION
+    };
+    char     buf[256];
+    uint64_t h = FNV_OFFSET;
+
+    for (size_t i = 0; i < sizeof(pinfo) / sizeof(pinfo[0]); i++) {
+        buf[0] = '\0';
+        clGetPlatformInfo(ctx->platform_id, pinfo[i], sizeof(buf), buf, NULL);
+        buf[sizeof(buf) - 1] = '\0';
+        h = fnv1a_str(h, buf);
+    }
+    for (size_t i = 0; i < sizeof(dinfo) / sizeof(dinfo[0]); i++) {
+        buf[0] = '\0';
+        clGetDeviceInfo(ctx->device_id, dinfo[i], sizeof(buf), buf, NULL);
+        buf[sizeof(buf) - 1] = '\0';
+        h = fnv1a_str(h, buf);
+    }
+    h = fnv1a_str(h, source);
+    return fnv1a_str(h, build_options ? build_options : "");
+}
+
+static void cache_path(char* path, size_t size, uint64_t key)
+{
+    snprintf(path, size, "%s/%016llx.bin", cache_dir,
+             (unsigned long long)key);
+}
+
+/* Create and open the unique file named by template (ending in XXXXXX) */
+static FILE* open_temp(char* template)
+{
+#if defined(_WIN32)
+    if (_mktemp_s(template, strlen(template) + 1) != 0)
+        return NULL;
+    int fd = _open(template, _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY,
+                   _S_IREAD | _S_IWRITE);
+    return fd < 0 ? NULL : _fdopen(fd, "wb");
+#else
+    int fd = mkstemp(template);
+    if (fd < 0)
+        return NULL;
+    fchmod(fd, 0644);                   /* mkstemp gives 0600; as fopen would */
+    FILE* f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        remove(template);
+    }
+    return f;
+#endif
+}
+
+cl_program cl_cache_load(CLContext* ctx, const char* source,
+                         const char* build_options)
+{
+    if (!cache_dir)
+        return NULL;
+
+    char     path[1024];
+    uint64_t key = cache_key(ctx, source, build_options);
+    cache_path(path, sizeof(path), key);
+
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    CacheHeader    hdr;
+    unsigned char* binary = NULL;
+    if (fread(&hdr, sizeof(hdr), 1, f) == 1
+        && memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) == 0
+        && hdr.key == key && hdr.size > 0 && hdr.size < ((uint64_t)1 << 30)) {
+        binary = (unsigned char*)malloc((size_t)hdr.size);
+        if (binary && (fread(binary, 1, (size_t)hdr.size, f) != hdr.size
+                       || fnv1a(FNV_OFFSET, binary, (size_t)hdr.size)
+                          != hdr.checksum)) {
+            free(binary);
+            binary = NULL;
+        }
+    }
+    fclose(f);
+    if (!binary) {
+        fprintf(stderr, "[OpenCL] Ignoring corrupt cache entry %s\n", path);
+        return NULL;
+    }
+
+    size_t               size = (size_t)hdr.size;
+    const unsigned char* bins = binary;
+    cl_int               status, err;
+    cl_program program = clCreateProgramWithBinary(ctx->context, 1,
+                                                   &ctx->device_id, &size,
+                                                   &bins, &status, &err);
+    free(binary);
+    if (err != CL_SUCCESS || status != CL_SUCCESS) {
+        if (program) clReleaseProgram(program);
+        return NULL;
+    }
+    /* a binary still has to be "built" (linked) for the device */
+    if (clBuildProgram(program, 1, &ctx->device_id, build_options,
+                       NULL, NULL) != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+void cl_cache_store(CLContext* ctx, cl_program program, const char* source,
+                    const char* build_options)
+{
+    if (!cache_dir)
+        return;
+
+    size_t size = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size),
+                         &size, NULL) != CL_SUCCESS || size == 0)
+        return;
+    unsigned char* binary = (unsigned char*)malloc(size);
+    if (!binary)
+        return;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary),
+                         &binary, NULL) != CL_SUCCESS) {
+        free(binary);
+        return;
+    }
+
+    CacheHeader hdr;
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.key      = cache_key(ctx, source, build_options);
+    hdr.size     = size;
+    hdr.checksum = fnv1a(FNV_OFFSET, binary, size);
+
+    /* write a private temp file, then rename: readers never see half.
+     * Several engines of one process (batch --ocl workers) can store the
+     * same key at once, so the name must be unique per writer. */
+    char path[1024], tmp[1100];
+    cache_path(path, sizeof(path), hdr.key);
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    FILE* f = create_output_directories(path) == 0 ? open_temp(tmp) : NULL;
+    if (f) {
+        int ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+              && fwrite(binary, 1, size, f) == size;
+        if (fclose(f) != 0)
+            ok = 0;
+#if defined(_WIN32)
+        remove(path);               /* rename does not replace here */
+#endif
+        if (!ok || rename(tmp, path) != 0)
+            remove(tmp);
+    }
+    free(binary);
+}
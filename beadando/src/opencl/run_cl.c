@@ -1,8 +1,10 @@
 #include "opencl/run_cl.h"
 #include "opencl/kernel_loader.h"
+#include "opencl/program_cache.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define CL_CHECK(err, label, msg)                                        \
     do {                                                                  \
@@ -36,11 +38,292 @@ static int buffer_needs_upload(const CLBufferDesc* desc)
            (desc->flags & CL_MEM_READ_WRITE);
 }
 
+static int upload_segments(CLContext* ctx, cl_mem buf, const CLBufferDesc* desc)
+{
+    size_t offset = 0;
+    for (int s = 0; s < desc->n_segments; ++s) {
+        const CLHostSegment* seg = &desc->segments[s];
+        if (offset + seg->size > desc->size) {
+            fprintf(stderr, "[OpenCL] Segments overflow a %zu-byte buffer\n",
+                    desc->size);
+            return -1;
+        }
+        cl_int err = clEnqueueWriteBuffer(ctx->command_queue, buf, CL_FALSE,
+                                          offset, seg->size, seg->ptr,
+                                          0, NULL, NULL);
+        if (err != CL_SUCCESS) {
+            fprintf(stderr, "[OpenCL] clEnqueueWriteBuffer failed for "
+                            "segment %d (code %d)\n", s, err);
+            return -1;
+        }
+        offset += seg->size;
+    }
+    return 0;
+}
+
+static char* dup_string(const char* s)
+{
+    char* d = (char*)malloc(strlen(s) + 1);
+    if (d) strcpy(d, s);
+    return d;
+}
+
+static void release_program_entry(CLProgramEntry* e)
+{
+    if (e->program) clReleaseProgram(e->program);
+    free(e->source_path);
+    free(e->build_options);
+    memset(e, 0, sizeof(*e));
+}
+
+static void release_kernel_entry(CLKernelEntry* e)
+{
+    if (e->kernel) clReleaseKernel(e->kernel);
+    free(e->kernel_name);
+    memset(e, 0, sizeof(*e));
+}
+
+static cl_program build_program(CLContext* ctx, const char* source_path,
+                                const char* build_options)
+{
+    int    loader_err;
+    cl_int err;
+    char*  source = load_kernel_source(source_path, &loader_err);
+    if (loader_err != 0) {
+        fprintf(stderr, "[OpenCL] Could not load kernel source: %s\n",
+                source_path);
+        return NULL;
+    }
+
+    cl_program program = cl_cache_load(ctx, source, build_options);
+    if (program) {
+        free(source);
+        return program;
+    }
+
+    program = clCreateProgramWithSource(ctx->context, 1,
+                                        (const char**)&source, NULL, &err);
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "[OpenCL] clCreateProgramWithSource failed "
+                        "(code %d)\n", err);
+        free(source);
+        return NULL;
+    }
+
+    err = clBuildProgram(program, 1, &ctx->device_id, build_options,
+                         NULL, NULL);
+    if (err != CL_SUCCESS) {
+        print_build_log(program, ctx->device_id);
+        clReleaseProgram(program);
+        free(source);
+        return NULL;
+    }
+    cl_cache_store(ctx, program, source, build_options);
+    free(source);
+    return program;
+}
+
+/* Cached program for (source_path, build_options), built on a miss */
+static cl_program get_program(CLContext* ctx, const char* source_path,
+                              const char* build_options)
+{
+    const char* opts = build_options ? build_options : "";
+    int used = ctx->n_programs < CL_CACHE_SLOTS ? ctx->n_programs
+                                                : CL_CACHE_SLOTS;
+    for (int i = 0; i < used; i++) {
+        CLProgramEntry* e = &ctx->programs[i];
+        if (strcmp(e->source_path, source_path) == 0
+            && strcmp(e->build_options, opts) == 0)
+            return e->program;
+    }
+
+    cl_program program = build_program(ctx, source_path, build_options);
+    if (!program)
+        return NULL;
+
+    CLProgramEntry* e = &ctx->programs[ctx->n_programs++ % CL_CACHE_SLOTS];
+    release_program_entry(e);
+    e->source_path   = dup_string(source_path);
+    e->build_options = dup_string(opts);
+    e->program       = program;
+    if (!e->source_path || !e->build_options) {
+        release_program_entry(e);
+        return NULL;
+    }
+    return program;
+}
+
+cl_kernel cl_get_kernel(CLContext* ctx, const char* source_path,
+                        const char* kernel_name, const char* build_options)
+{
+    cl_program program = get_program(ctx, source_path, build_options);
+    if (!program)
+        return NULL;
+
+    int used = ctx->n_kernels < CL_CACHE_SLOTS ? ctx->n_kernels
+                                               : CL_CACHE_SLOTS;
+    for (int i = 0; i < used; i++) {
+        CLKernelEntry* e = &ctx->kernels[i];
+        if (e->program == program && strcmp(e->kernel_name, kernel_name) == 0)
+            return e->kernel;
+    }
+
+    cl_int    err;
+    cl_kernel kernel = clCreateKernel(program, kernel_name, &err);
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "[OpenCL] clCreateKernel failed for '%s' (code %d)\n",
+                kernel_name, err);
+        return NULL;
+    }
+
+    CLKernelEntry* e = &ctx->kernels[ctx->n_kernels++ % CL_CACHE_SLOTS];
+    release_kernel_entry(e);
+    e->program     = program;
+    e->kernel_name = dup_string(kernel_name);
+    e->kernel      = kernel;
+    if (!e->kernel_name) {
+        release_kernel_entry(e);
+        return NULL;
+    }
+    return kernel;
+}
+
+/* ============================================================
+ * Device buffer pool
+ * ============================================================ */
+
+/* Four capacity classes per power of two, at least 4 KiB */
+static size_t pool_class(size_t size)
+{
+    if (size <= 4096)
+        return 4096;
+    int    msb  = 63 - __builtin_clzll((unsigned long long)size);
+    size_t step = (size_t)1 << (msb - 2);
+    return (size + step - 1) & ~(step - 1);
+}
+
+static int pool_acquire(CLContext* ctx, size_t size, CLDeviceBuffer* out)
+{
+    size_t cap = pool_class(size);
+    for (int i = ctx->n_pool - 1; i >= 0; i--) {
+        if (ctx->pool[i].size == cap) {
+            *out = ctx->pool[i];
+            memmove(&ctx->pool[i], &ctx->pool[i + 1],
+                    (size_t)(ctx->n_pool - 1 - i) * sizeof(CLDeviceBuffer));
+            ctx->n_pool--;
+            return 0;
+        }
+    }
+
+    cl_int err;
+    out->mem  = clCreateBuffer(ctx->context, CL_MEM_READ_WRITE, cap, NULL,
+                               &err);
+    out->size = cap;
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "[OpenCL] clCreateBuffer failed for %zu bytes "
+                        "(code %d)\n", cap, err);
+        return -1;
+    }
+    return 0;
+}
+
+/* Park buf as the newest idle entry, evicting the oldest over the limit */
+static void pool_release(CLContext* ctx, CLDeviceBuffer buf)
+{
+    if (!buf.mem)
+        return;
+    size_t idle = buf.size;
+    for (int i = 0; i < ctx->n_pool; i++)
+        idle += ctx->pool[i].size;
+
+    while (ctx->n_pool > 0
+           && (ctx->n_pool == CL_POOL_SLOTS || idle > CL_POOL_LIMIT)) {
+        idle -= ctx->pool[0].size;
+        clReleaseMemObject(ctx->pool[0].mem);
+        memmove(&ctx->pool[0], &ctx->pool[1],
+                (size_t)(ctx->n_pool - 1) * sizeof(CLDeviceBuffer));
+        ctx->n_pool--;
+    }
+    if (buf.size > CL_POOL_LIMIT) {
+        clReleaseMemObject(buf.mem);
+        return;
+    }
+    ctx->pool[ctx->n_pool++] = buf;
+}
+
+static const CLPinnedBuffer* find_pinned(const CLContext* ctx,
+                                         const void* host, size_t size)
+{
+    if (!host)
+        return NULL;
+    for (int i = 0; i < CL_PIN_SLOTS; i++)
+        if (ctx->pinned[i].host == host && ctx->pinned[i].size >= size)
+            return &ctx->pinned[i];
+    return NULL;
+}
+
+int cl_is_pinned(const CLContext* ctx, const void* host, size_t size)
+{
+    return find_pinned(ctx, host, size) != NULL;
+}
+
+int cl_pin(CLContext* ctx, const void* host, size_t size)
+{
+    if (!host || size == 0) {
+        fprintf(stderr, "[OpenCL] Cannot pin an empty host range\n");
+        return -1;
+    }
+
+    CLPinnedBuffer* slot = NULL;
+    for (int i = 0; i < CL_PIN_SLOTS && !slot; i++)
+        if (ctx->pinned[i].host == host)
+            slot = &ctx->pinned[i];
+    if (slot && slot->buf.size < size) {
+        cl_unpin(ctx, host);                /* grown: take a larger buffer */
+        slot = NULL;
+    }
+    for (int i = 0; i < CL_PIN_SLOTS && !slot; i++)
+        if (!ctx->pinned[i].host)
+            slot = &ctx->pinned[i];
+    if (!slot) {
+        fprintf(stderr, "[OpenCL] Cannot pin: all %d slots are in use\n",
+                CL_PIN_SLOTS);
+        return -1;
+    }
+
+    /* a re-pin keeps its buffer and only refreshes the contents */
+    if (!slot->host && pool_acquire(ctx, size, &slot->buf) != 0)
+        return -1;
+    cl_int err = clEnqueueWriteBuffer(ctx->command_queue, slot->buf.mem,
+                                      CL_TRUE, 0, size, host, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "[OpenCL] Pin upload failed (code %d)\n", err);
+        pool_release(ctx, slot->buf);
+        memset(slot, 0, sizeof(*slot));
+        return -1;
+    }
+    slot->host = host;
+    slot->size = size;
+    return 0;
+}
+
+void cl_unpin(CLContext* ctx, const void* host)
+{
+    for (int i = 0; i < CL_PIN_SLOTS; i++) {
+        if (host && ctx->pinned[i].host == host) {
+            pool_release(ctx, ctx->pinned[i].buf);
+            memset(&ctx->pinned[i], 0, sizeof(ctx->pinned[i]));
+        }
+    }
+}
+
 int cl_init(CLContext* ctx)
 {
     cl_int  err;
     cl_uint count;
 
+    memset(ctx, 0, sizeof(*ctx));
+
     err = clGetPlatformIDs(1, &ctx->platform_id, &count);
     CL_CHECK(err, fail, "clGetPlatformIDs failed");
 
@@ -64,6 +347,15 @@ fail:     return -1;
 
 void cl_cleanup(CLContext* ctx)
 {
+    for (int i = 0; i < CL_PIN_SLOTS; i++)
+        if (ctx->pinned[i].buf.mem)
+            clReleaseMemObject(ctx->pinned[i].buf.mem);
+    for (int i = 0; i < ctx->n_pool; i++)
+        clReleaseMemObject(ctx->pool[i].mem);
+    for (int i = 0; i < CL_CACHE_SLOTS; i++)
+        release_kernel_entry(&ctx->kernels[i]);
+    for (int i = 0; i < CL_CACHE_SLOTS; i++)
+        release_program_entry(&ctx->programs[i]);
     clReleaseCommandQueue(ctx->command_queue);
     clReleaseContext(ctx->context);
     clReleaseDevice(ctx->device_id);
@@ -76,56 +368,50 @@ int cl_run_kernel(CLContext*          ctx,
                   CLArgBindFn         bind_args,
                   void*               user_data)
 {
-    cl_int     err;
-    int        i, ret        = -1;
-    int        loader_err;
-    char*      source        = NULL;
-    cl_program program       = NULL;
-    cl_kernel  kernel        = NULL;
-    cl_mem*    device_bufs   = NULL;
+    cl_int          err;
+    int             i, ret        = -1;
+    cl_kernel       kernel        = NULL;
+    cl_mem*         device_bufs   = NULL;
+    CLDeviceBuffer* pooled        = NULL;   /* mem == NULL: pinned */
 
     device_bufs = (cl_mem*)calloc((size_t)n_bufs, sizeof(cl_mem));
-    if (!device_bufs) {
+    pooled      = (CLDeviceBuffer*)calloc((size_t)n_bufs,
+                                          sizeof(CLDeviceBuffer));
+    if (!device_bufs || !pooled) {
         fprintf(stderr, "[OpenCL] Out of memory for buffer handle array\n");
         goto cleanup;
     }
 
-    source = load_kernel_source(kd->source_path, &loader_err);
-    if (loader_err != 0) {
-        fprintf(stderr, "[OpenCL] Could not load kernel source: %s\n",
-                kd->source_path);
+    kernel = cl_get_kernel(ctx, kd->source_path, kd->kernel_name,
+                           kd->build_options);
+    if (!kernel)
         goto cleanup;
-    }
 
-    program = clCreateProgramWithSource(ctx->context, 1,
-                                        (const char**)&source, NULL, &err);
-    CL_CHECK(err, cleanup, "clCreateProgramWithSource failed");
+    for (i = 0; i < n_bufs; ++i) {
+        const CLPinnedBuffer* pin = find_pinned(ctx, bufs[i].host_ptr,
+                                                bufs[i].size);
+        if (pin) {
+            device_bufs[i] = pin->buf.mem;
+            continue;
+        }
 
-    err = clBuildProgram(program, 1, &ctx->device_id, NULL, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        print_build_log(program, ctx->device_id);
-        goto cleanup;
-    }
+        if (pool_acquire(ctx, bufs[i].size, &pooled[i]) != 0)
+            goto cleanup;
+        device_bufs[i] = pooled[i].mem;
 
-    kernel = clCreateKernel(program, kd->kernel_name, &err);
-    CL_CHECK(err, cleanup, "clCreateKernel failed");
+        if (buffer_needs_upload(&bufs[i])) {
+            err = clEnqueueWriteBuffer(ctx->command_queue, device_bufs[i],
+                                       CL_FALSE, 0, bufs[i].size,
+                                       bufs[i].host_ptr, 0, NULL, NULL);
+            if (err != CL_SUCCESS) {
+                fprintf(stderr, "[OpenCL] clEnqueueWriteBuffer failed for "
+                                "buffer %d (code %d)\n", i, err);
+                goto cleanup;
+            }
+        }
 
-    for (i = 0; i < n_bufs; ++i) {
-        cl_mem_flags alloc_flags = bufs[i].flags;
-        if (buffer_needs_upload(&bufs[i]))
-            alloc_flags |= CL_MEM_COPY_HOST_PTR;
-
-        device_bufs[i] = clCreateBuffer(ctx->context,
-                                        alloc_flags,
-                                        bufs[i].size,
-                                        buffer_needs_upload(&bufs[i])
-                                            ? bufs[i].host_ptr : NULL,
-                                        &err);
-        if (err != CL_SUCCESS) {
-            fprintf(stderr, "[OpenCL] clCreateBuffer failed for buffer %d "
-                            "(code %d)\n", i, err);
+        if (upload_segments(ctx, device_bufs[i], &bufs[i]) != 0)
             goto cleanup;
-        }
     }
 
     if (bind_args(kernel, device_bufs, n_bufs, user_data) != 0) {
@@ -165,13 +451,12 @@ int cl_run_kernel(CLContext*          ctx,
     ret = 0;
 
 cleanup:
-    for (i = n_bufs - 1; i >= 0; --i)
-        if (device_bufs && device_bufs[i])
-            clReleaseMemObject(device_bufs[i]);
+    if (ret != 0)
+        clFinish(ctx->command_queue);   /* no transfer may outlive pooling */
+    for (i = 0; pooled && i < n_bufs; ++i)
+        pool_release(ctx, pooled[i]);
 
+    free(pooled);
     free(device_bufs);
-    if (kernel)  clReleaseKernel(kernel);
-    if (program) clReleaseProgram(program);
-    free(source);
     return ret;
 }
\ No newline at end of file
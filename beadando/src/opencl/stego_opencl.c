@@ -1,5 +1,7 @@
+#include "common/stego_scatter.h"
 #include "common/stego_utils.h"
 #include "opencl/stego_opencl.h"
+#include "openmp/stego_kernels.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,7 +11,36 @@
 #define KERNEL_PATH  "kernels/steganography.cl"
 #define LOCAL_SIZE   256u
 
-typedef struct { int total_bits; } EncodeArgs;
+/* Trailing scatter arguments of the keyed kernels */
+typedef struct { cl_ulong domain; cl_uint half; cl_uint4 keys; } ScatterArgs;
+
+static ScatterArgs scatter_args(const StegoKey* key, size_t img_size)
+{
+    StegoScatter sc;
+    stego_scatter_init(&sc, key, img_size - STEGO_HEADER_CARRIER);
+
+    ScatterArgs a;
+    a.domain = sc.domain;
+    a.half   = sc.half;
+    for (int i = 0; i < STEGO_SCATTER_ROUNDS; i++)
+        a.keys.s[i] = sc.round[i];
+    return a;
+}
+
+static cl_int bind_scatter(cl_kernel kernel, cl_uint first,
+                           const ScatterArgs* a)
+{
+    cl_int err = CL_SUCCESS;
+    err |= clSetKernelArg(kernel, first,     sizeof(cl_ulong), &a->domain);
+    err |= clSetKernelArg(kernel, first + 1, sizeof(cl_uint),  &a->half);
+    err |= clSetKernelArg(kernel, first + 2, sizeof(cl_uint4), &a->keys);
+    return err;
+}
+
+typedef struct {
+    int n_carriers; int body_len;
+    int keyed;      ScatterArgs scatter;
+} EncodeArgs;
 
 static int encode_bind(cl_kernel kernel, cl_mem* bufs,
                        int n_bufs, void* user_data)
@@ -19,11 +50,17 @@ static int encode_bind(cl_kernel kernel, cl_mem* bufs,
     cl_int err = CL_SUCCESS;
     err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufs[0]);
     err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufs[1]);
-    err |= clSetKernelArg(kernel, 2, sizeof(int),    &a->total_bits);
+    err |= clSetKernelArg(kernel, 2, sizeof(int),    &a->n_carriers);
+    err |= clSetKernelArg(kernel, 3, sizeof(int),    &a->body_len);
+    if (a->keyed)
+        err |= bind_scatter(kernel, 4, &a->scatter);
     return (err == CL_SUCCESS) ? 0 : -1;
 }
 
-typedef struct { int bit_offset; int num_bytes; } DecodeArgs;
+typedef struct {
+    int capacity;
+    int keyed;    ScatterArgs scatter;
+} DecodeArgs;
 
 static int decode_bind(cl_kernel kernel, cl_mem* bufs,
                        int n_bufs, void* user_data)
@@ -33,115 +70,196 @@ static int decode_bind(cl_kernel kernel, cl_mem* bufs,
     cl_int err = CL_SUCCESS;
     err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufs[0]);
     err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufs[1]);
-    err |= clSetKernelArg(kernel, 2, sizeof(int),    &a->bit_offset);
-    err |= clSetKernelArg(kernel, 3, sizeof(int),    &a->num_bytes);
+    err |= clSetKernelArg(kernel, 2, sizeof(int),    &a->capacity);
+    if (a->keyed)
+        err |= bind_scatter(kernel, 3, &a->scatter);
     return (err == CL_SUCCESS) ? 0 : -1;
 }
 
+/* "-DBITS=<k>": each k gets its own specialised build of the kernels */
+static void bits_option(char* buf, size_t size, int bits)
+{
+    snprintf(buf, size, "-DBITS=%d", bits);
+}
+
 static size_t round_up(size_t n)
 {
     return ((n + LOCAL_SIZE - 1) / LOCAL_SIZE) * LOCAL_SIZE;
 }
 
-int stego_encode_ocl(CLContext* ctx, Image* img, const StegoMessage* msg)
+int stego_encode_ocl_segments(CLContext* ctx, Image* img,
+                              const StegoSegment* body, int n_body, int bits)
+{
+    return stego_encode_ocl_keyed(ctx, img, body, n_body, bits, NULL);
+}
+
+int stego_encode_ocl_keyed(CLContext* ctx, Image* img,
+                           const StegoSegment* body, int n_body, int bits,
+                           const StegoKey* key)
 {
-    if (stego_check_capacity(img, msg) != 0)
+    StegoPayload payload;
+    if (stego_payload_init(&payload, body, n_body, bits) != 0)
+        return -1;
+    if (payload.length > STEGO_OCL_MAX_LENGTH) {
+        fprintf(stderr, "[stego/ocl] Message of %zu bytes exceeds the OpenCL "
+                        "limit of %zu bytes\n",
+                payload.length, STEGO_OCL_MAX_LENGTH);
+        return -1;
+    }
+    if (stego_check_capacity(img, payload.length, bits) != 0)
         return -1;
 
-    size_t framed_len;
-    uint8_t* payload = stego_frame(msg, &framed_len);
-    if (!payload) return -1;
+    CLHostSegment segs[1 + STEGO_MAX_SEGMENTS];
+    segs[0].ptr  = payload.header;
+    segs[0].size = 4;
+    for (int i = 0; i < payload.n_segs; i++) {
+        segs[1 + i].ptr  = payload.segs[i].data;
+        segs[1 + i].size = payload.segs[i].length;
+    }
 
-    int total_bits  = (int)(framed_len * 8);
-    size_t gs       = round_up((size_t)total_bits);
+    int n_carriers  = (int)stego_carrier_bytes(payload.length, bits);
+    size_t gs       = round_up((size_t)n_carriers);
     size_t ls       = LOCAL_SIZE;
     size_t img_size = (size_t)img->width * img->height * img->channels;
 
+    /* A sequential frame only rewrites carriers [0, n_carriers): move just
+     * that prefix both ways.  The keyed order can land anywhere. */
+    size_t touched  = key ? img_size : (size_t)n_carriers;
+
     CLBufferDesc bufs[] = {
-        { img->pixels, img_size,       CL_MEM_READ_WRITE, 1 },
-        { payload,     framed_len,     CL_MEM_READ_ONLY,  0 },
+        { img->pixels, touched,            CL_MEM_READ_WRITE, 1, NULL, 0 },
+        { NULL,        4 + payload.length, CL_MEM_READ_ONLY,  0,
+          segs, 1 + payload.n_segs },
     };
 
+    char options[32];
+    bits_option(options, sizeof(options), bits);
+
     CLKernelDesc kd = {
-        .source_path = KERNEL_PATH,
-        .kernel_name = "encode_kernel",
-        .work_dim    = 1,
-        .global_size = &gs,
-        .local_size  = &ls,
+        .source_path   = KERNEL_PATH,
+        .kernel_name   = key ? "encode_scatter_kernel" : "encode_kernel",
+        .work_dim      = 1,
+        .global_size   = &gs,
+        .local_size    = &ls,
+        .build_options = options,
     };
 
-    EncodeArgs args = { total_bits };
-    int ret = cl_run_kernel(ctx, &kd, bufs, 2, encode_bind, &args);
+    EncodeArgs args;
+    memset(&args, 0, sizeof(args));
+    args.n_carriers = n_carriers;
+    args.body_len   = (int)payload.length;
+    args.keyed      = key != NULL;
+    if (key)
+        args.scatter = scatter_args(key, img_size);
+    return cl_run_kernel(ctx, &kd, bufs, 2, encode_bind, &args);
+}
 
-    free(payload);
-    return ret;
+int stego_encode_ocl(CLContext* ctx, Image* img, const StegoMessage* msg,
+                     int bits)
+{
+    StegoSegment body = { msg->data, msg->length };
+    return stego_encode_ocl_segments(ctx, img, &body, 1, bits);
 }
 
-int stego_decode_ocl(CLContext* ctx, const Image* img, StegoMessage* msg)
+int stego_decode_ocl_into(CLContext* ctx, const Image* img, uint8_t** buf,
+                          size_t* cap, size_t* length)
+{
+    return stego_decode_ocl_keyed_into(ctx, img, NULL, buf, cap, length);
+}
+
+int stego_ocl_pin_image(CLContext* ctx, const Image* img)
+{
+    return cl_pin(ctx, img->pixels,
+                  (size_t)img->width * img->height * img->channels);
+}
+
+void stego_ocl_unpin_image(CLContext* ctx, const Image* img)
+{
+    cl_unpin(ctx, img->pixels);
+}
+
+int stego_decode_ocl_keyed_into(CLContext* ctx, const Image* img,
+                                const StegoKey* key, uint8_t** buf,
+                                size_t* cap, size_t* length)
 {
     size_t img_size = (size_t)img->width * img->height * img->channels;
-    if (img_size < 32) {
+    if (img_size < STEGO_HEADER_CARRIER) {
         fprintf(stderr, "[stego/ocl] Carrier too small to hold a header\n");
         return -1;
     }
 
-    uint8_t len_bytes[4] = {0};
-    {
-        size_t gs = round_up(4);
-        size_t ls = LOCAL_SIZE;
-
-        CLBufferDesc bufs[] = {
-            { (void*)img->pixels, img_size,    CL_MEM_READ_ONLY,  0 },
-            { len_bytes,          4,           CL_MEM_WRITE_ONLY, 1 },
-        };
-        CLKernelDesc kd = {
-            .source_path = KERNEL_PATH,
-            .kernel_name = "decode_kernel",
-            .work_dim    = 1,
-            .global_size = &gs,
-            .local_size  = &ls,
-        };
-        DecodeArgs args = { 0, 4 };
-        if (cl_run_kernel(ctx, &kd, bufs, 2, decode_bind, &args) != 0)
-            return -1;
-    }
-
-    uint32_t len32 =  (uint32_t)len_bytes[0]
-                   | ((uint32_t)len_bytes[1] <<  8)
-                   | ((uint32_t)len_bytes[2] << 16)
-                   | ((uint32_t)len_bytes[3] << 24);
-
-    if (len32 == 0 || (size_t)(4 + len32) * 8 > img_size) {
+    /* The 32 header carriers are in host memory already: peeking them
+     * sizes the output and picks the build without a device round trip. */
+    uint8_t header[4];
+    size_t  len;
+    int     bits;
+    stego_kernels()->decode(header, img->pixels, sizeof(header));
+    if (stego_header_decode(header, &len, &bits) != 0
+        || stego_carrier_bytes(len, bits) > img_size) {
         fprintf(stderr,
-                "[stego/ocl] Invalid embedded length %u\n", len32);
+                "[stego/ocl] Invalid embedded length %zu at k=%d\n",
+                len, bits);
+        return -1;
+    }
+    if (len > STEGO_OCL_MAX_LENGTH) {
+        fprintf(stderr, "[stego/ocl] Embedded message of %zu bytes exceeds "
+                        "the OpenCL limit of %zu bytes\n",
+                len, STEGO_OCL_MAX_LENGTH);
         return -1;
     }
 
-    msg->length = (size_t)len32;
-    msg->data   = (uint8_t*)malloc(len32);
-    if (!msg->data) return -1;
-
-    {
-        size_t gs = round_up((size_t)len32);
-        size_t ls = LOCAL_SIZE;
-
-        CLBufferDesc bufs[] = {
-            { (void*)img->pixels, img_size, CL_MEM_READ_ONLY,  0 },
-            { msg->data,          len32,    CL_MEM_WRITE_ONLY, 1 },
-        };
-        CLKernelDesc kd = {
-            .source_path = KERNEL_PATH,
-            .kernel_name = "decode_kernel",
-            .work_dim    = 1,
-            .global_size = &gs,
-            .local_size  = &ls,
-        };
-        DecodeArgs args = { 32, (int)len32 };
-        if (cl_run_kernel(ctx, &kd, bufs, 2, decode_bind, &args) != 0) {
-            stego_message_free(msg);
-            return -1;
-        }
+    if (len > *cap) {
+        uint8_t* grown = (uint8_t*)realloc(*buf, len);
+        if (!grown) return -1;
+        *buf = grown;
+        *cap = len;
     }
 
+    /* One launch; the kernel re-reads the header from the carrier and
+     * guards with it.  Upload just the frame prefix (whole image if keyed). */
+    size_t gs     = round_up(len);
+    size_t ls     = LOCAL_SIZE;
+    size_t needed = key ? img_size : stego_carrier_bytes(len, bits);
+
+    CLBufferDesc bufs[] = {
+        { (void*)img->pixels, needed, CL_MEM_READ_ONLY,  0, NULL, 0 },
+        { *buf,               len,    CL_MEM_WRITE_ONLY, 1, NULL, 0 },
+    };
+
+    char options[32];
+    bits_option(options, sizeof(options), bits);
+
+    CLKernelDesc kd = {
+        .source_path   = KERNEL_PATH,
+        .kernel_name   = key ? "decode_frame_scatter_kernel"
+                             : "decode_frame_kernel",
+        .work_dim      = 1,
+        .global_size   = &gs,
+        .local_size    = &ls,
+        .build_options = options,
+    };
+
+    DecodeArgs args;
+    memset(&args, 0, sizeof(args));
+    args.capacity = (int)len;
+    args.keyed    = key != NULL;
+    if (key)
+        args.scatter = scatter_args(key, img_size);
+    if (cl_run_kernel(ctx, &kd, bufs, 2, decode_bind, &args) != 0)
+        return -1;
+
+    *length = len;
+    return 0;
+}
+
+int stego_decode_ocl(CLContext* ctx, const Image* img, StegoMessage* msg)
+{
+    uint8_t* buf = NULL;
+    size_t   cap = 0;
+    if (stego_decode_ocl_into(ctx, img, &buf, &cap, &msg->length) != 0) {
+        free(buf);
+        return -1;
+    }
+    msg->data = buf;
     return 0;
-}
\ No newline at end of file
+}
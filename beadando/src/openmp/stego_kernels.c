@@ -0,0 +1,337 @@
+#include "openmp/stego_kernels.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define STEGO_X86_DISPATCH 1
+#  include <immintrin.h>
+#  define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* ======================================================================
+ * Scalar (SWAR) variants
+ * ====================================================================== */
+
+/*
+ * Spread the 8 bits of b into the LSB of 8 consecutive little-endian bytes.
+ * Bit 7 is placed separately: with all 8 bits the multiply would carry.
+ */
+static inline uint64_t spread_bits(uint8_t b)
+{
+    return (((uint64_t)(b & 0x7Fu) * 0x0002040810204081ULL)
+            & 0x0101010101010101ULL)
+         | ((uint64_t)(b >> 7) << 56);
+}
+
+/* One payload byte -> 8 carrier bytes as a single 64-bit word. */
+static void encode_scalar(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+        uint64_t w;
+        memcpy(&w, dst + 8 * j, 8);
+        w = (w & 0xFEFEFEFEFEFEFEFEULL) | spread_bits(src[j]);
+        memcpy(dst + 8 * j, &w, 8);
+    }
+}
+
+/* Gather the LSBs of 8 carrier bytes with one multiply. */
+static void decode_scalar(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+        uint64_t w;
+        memcpy(&w, src + 8 * j, 8);
+        dst[j] = (uint8_t)(((w & 0x0101010101010101ULL)
+                            * 0x0102040810204080ULL) >> 56);
+    }
+}
+
+/* ======================================================================
+ * k-LSB variants (k = 2..4)
+ *
+ * K payload bytes carry 8K bits, which land in exactly 8 carrier bytes,
+ * so every group is one 64-bit SWAR word.  K is a compile-time constant
+ * in each instantiation and the shift loops fully unroll.
+ * ====================================================================== */
+
+static inline void klsb_encode(uint8_t* dst, const uint8_t* src, size_t n,
+                               const int K)
+{
+    const uint64_t mask = (1u << K) - 1;
+    const uint64_t lane = mask * 0x0101010101010101ULL;
+    size_t groups = n / K;
+
+    for (size_t g = 0; g < groups; g++) {
+        uint64_t v = 0, spread = 0, w;
+        memcpy(&v, src + (size_t)K * g, K);
+        for (int c = 0; c < 8; c++)
+            spread |= ((v >> (K * c)) & mask) << (8 * c);
+        memcpy(&w, dst + 8 * g, 8);
+        w = (w & ~lane) | spread;
+        memcpy(dst + 8 * g, &w, 8);
+    }
+
+    size_t rest = n - groups * K;
+    if (rest) {
+        uint64_t v = 0;
+        uint8_t* d = dst + 8 * groups;
+        memcpy(&v, src + (size_t)K * groups, rest);
+        for (size_t c = 0; c < (8 * rest + K - 1) / K; c++)
+            d[c] = (uint8_t)((d[c] & ~mask) | ((v >> (K * c)) & mask));
+    }
+}
+
+static inline void klsb_decode(uint8_t* dst, const uint8_t* src, size_t n,
+                               const int K)
+{
+    const uint64_t mask = (1u << K) - 1;
+    size_t groups = n / K;
+
+    for (size_t g = 0; g < groups; g++) {
+        uint64_t w, v = 0;
+        memcpy(&w, src + 8 * g, 8);
+        for (int c = 0; c < 8; c++)
+            v |= ((w >> (8 * c)) & mask) << (K * c);
+        memcpy(dst + (size_t)K * g, &v, K);
+    }
+
+    size_t rest = n - groups * K;
+    if (rest) {
+        uint64_t v = 0;
+        const uint8_t* s = src + 8 * groups;
+        for (size_t c = 0; c < (8 * rest + K - 1) / K; c++)
+            v |= (uint64_t)(s[c] & mask) << (K * c);
+        memcpy(dst + (size_t)K * groups, &v, rest);
+    }
+}
+
+#define DEFINE_KLSB_KERNELS(K)                                          \
+    static void encode_k##K(uint8_t* dst, const uint8_t* src, size_t n) \
+    { klsb_encode(dst, src, n, K); }                                    \
+    static void decode_k##K(uint8_t* dst, const uint8_t* src, size_t n) \
+    { klsb_decode(dst, src, n, K); }
+
+DEFINE_KLSB_KERNELS(2)
+DEFINE_KLSB_KERNELS(3)
+DEFINE_KLSB_KERNELS(4)
+
+#ifdef STEGO_X86_DISPATCH
+
+/* ======================================================================
+ * SSE2 variants  --  2 payload bytes <-> 16 carrier bytes
+ * ====================================================================== */
+
+/* Unpack-broadcast each byte across 8 lanes, test bit k%8 of lane k. */
+TARGET("sse2")
+static void encode_sse2(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    const __m128i bit  = _mm_set1_epi64x((long long)0x8040201008040201ULL);
+    const __m128i one  = _mm_set1_epi8(1);
+    const __m128i keep = _mm_set1_epi8((char)0xFE);
+
+    size_t j = 0;
+    for (; j + 2 <= n; j += 2) {
+        __m128i v = _mm_cvtsi32_si128(src[j] | (src[j + 1] << 8));
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        v = _mm_unpacklo_epi32(v, v);
+        v = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v, bit), bit), one);
+        __m128i* p = (__m128i*)(dst + 8 * j);
+        __m128i c = _mm_loadu_si128(p);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(c, keep), v));
+    }
+    encode_scalar(dst + 8 * j, src + j, n - j);
+}
+
+/* Shift each LSB into its byte's sign bit, collect with movemask. */
+TARGET("sse2")
+static void decode_sse2(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    size_t j = 0;
+    for (; j + 2 <= n; j += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + 8 * j));
+        int mask = _mm_movemask_epi8(_mm_slli_epi16(v, 7));
+        dst[j]     = (uint8_t)mask;
+        dst[j + 1] = (uint8_t)(mask >> 8);
+    }
+    decode_scalar(dst + j, src + 8 * j, n - j);
+}
+
+/* ======================================================================
+ * AVX2 variants  --  4 payload bytes <-> 32 carrier bytes
+ * ====================================================================== */
+
+/* Broadcast the 32-bit word, route byte k/8 into lane k with a shuffle. */
+TARGET("avx2")
+static void encode_avx2(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    const __m256i route = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+        2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit  = _mm256_set1_epi64x((long long)0x8040201008040201ULL);
+    const __m256i one  = _mm256_set1_epi8(1);
+    const __m256i keep = _mm256_set1_epi8((char)0xFE);
+
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        uint32_t word;
+        memcpy(&word, src + j, 4);
+        __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)word), route);
+        v = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(v, bit), bit),
+                             one);
+        __m256i* p = (__m256i*)(dst + 8 * j);
+        __m256i c = _mm256_loadu_si256(p);
+        _mm256_storeu_si256(p, _mm256_or_si256(_mm256_and_si256(c, keep), v));
+    }
+    encode_scalar(dst + 8 * j, src + j, n - j);
+}
+
+TARGET("avx2")
+static void decode_avx2(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + 8 * j));
+        uint32_t word = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(v, 7));
+        memcpy(dst + j, &word, 4);
+    }
+    decode_scalar(dst + j, src + 8 * j, n - j);
+}
+
+/* ======================================================================
+ * AVX-512 variants  --  8 payload bytes <-> 64 carrier bytes
+ *
+ * With AVX512BW a payload qword *is* a byte mask: bit k selects lane k.
+ * ====================================================================== */
+
+TARGET("avx512f,avx512bw")
+static void encode_avx512(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    const __m512i keep = _mm512_set1_epi8((char)0xFE);
+    const __m512i one  = _mm512_set1_epi8(1);
+
+    size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        uint64_t word;
+        memcpy(&word, src + j, 8);
+        __m512i c = _mm512_and_si512(
+            _mm512_loadu_si512((const void*)(dst + 8 * j)), keep);
+        c = _mm512_mask_blend_epi8((__mmask64)word, c, _mm512_or_si512(c, one));
+        _mm512_storeu_si512((void*)(dst + 8 * j), c);
+    }
+    encode_avx2(dst + 8 * j, src + j, n - j);
+}
+
+TARGET("avx512f,avx512bw")
+static void decode_avx512(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    const __m512i one = _mm512_set1_epi8(1);
+
+    size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m512i v = _mm512_loadu_si512((const void*)(src + 8 * j));
+        uint64_t word = (uint64_t)_mm512_test_epi8_mask(v, one);
+        memcpy(dst + j, &word, 8);
+    }
+    decode_avx2(dst + j, src + 8 * j, n - j);
+}
+
+#endif /* STEGO_X86_DISPATCH */
+
+/* ======================================================================
+ * Dispatch table
+ * ====================================================================== */
+
+static const StegoKernels table[STEGO_ISA_COUNT] = {
+    { STEGO_ISA_SCALAR, "scalar", encode_scalar, decode_scalar },
+#ifdef STEGO_X86_DISPATCH
+    { STEGO_ISA_SSE2,   "sse2",   encode_sse2,   decode_sse2   },
+    { STEGO_ISA_AVX2,   "avx2",   encode_avx2,   decode_avx2   },
+    { STEGO_ISA_AVX512, "avx512", encode_avx512, decode_avx512 },
+#else
+    { STEGO_ISA_SSE2,   "sse2",   NULL, NULL },
+    { STEGO_ISA_AVX2,   "avx2",   NULL, NULL },
+    { STEGO_ISA_AVX512, "avx512", NULL, NULL },
+#endif
+};
+
+/* Read and written from concurrent engines (batch workers), so always
+ * through __atomic.  It points into the constant table: relaxed order is
+ * enough, and racing first users store the same row. */
+static const StegoKernels* active = NULL;
+
+static const StegoEncodeFn encode_klsb[STEGO_MAX_BITS + 1] = {
+    NULL, NULL, encode_k2, encode_k3, encode_k4
+};
+static const StegoDecodeFn decode_klsb[STEGO_MAX_BITS + 1] = {
+    NULL, NULL, decode_k2, decode_k3, decode_k4
+};
+
+static int isa_supported(StegoIsa isa)
+{
+    if (isa == STEGO_ISA_SCALAR) return 1;
+#ifdef STEGO_X86_DISPATCH
+    __builtin_cpu_init();
+    switch (isa) {
+    case STEGO_ISA_SSE2:   return __builtin_cpu_supports("sse2");
+    case STEGO_ISA_AVX2:   return __builtin_cpu_supports("avx2");
+    case STEGO_ISA_AVX512: return __builtin_cpu_supports("avx512f")
+                               && __builtin_cpu_supports("avx512bw");
+    default:               return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
+StegoIsa stego_isa_detect(void)
+{
+    for (int i = STEGO_ISA_COUNT - 1; i > STEGO_ISA_SCALAR; i--)
+        if (isa_supported((StegoIsa)i))
+            return (StegoIsa)i;
+    return STEGO_ISA_SCALAR;
+}
+
+int stego_kernels_select(StegoIsa isa)
+{
+    if (isa < 0 || isa >= STEGO_ISA_COUNT || !isa_supported(isa))
+        return -1;
+    __atomic_store_n(&active, &table[isa], __ATOMIC_RELAXED);
+    return 0;
+}
+
+const StegoKernels* stego_kernels(void)
+{
+    const StegoKernels* cur = __atomic_load_n(&active, __ATOMIC_RELAXED);
+    if (!cur) {
+        cur = &table[stego_isa_detect()];
+        __atomic_store_n(&active, cur, __ATOMIC_RELAXED);
+    }
+    return cur;
+}
+
+StegoEncodeFn stego_encode_kernel(int bits)
+{
+    if (bits < STEGO_MIN_BITS || bits > STEGO_MAX_BITS) return NULL;
+    return bits == 1 ? stego_kernels()->encode : encode_klsb[bits];
+}
+
+StegoDecodeFn stego_decode_kernel(int bits)
+{
+    if (bits < STEGO_MIN_BITS || bits > STEGO_MAX_BITS) return NULL;
+    return bits == 1 ? stego_kernels()->decode : decode_klsb[bits];
+}
+
+int stego_isa_parse(const char* name, StegoIsa* isa)
+{
+    if (strcmp(name, "auto") == 0) {
+        *isa = stego_isa_detect();
+        return 0;
+    }
+    for (int i = 0; i < STEGO_ISA_COUNT; i++) {
+        if (strcmp(name, table[i].name) == 0) {
+            *isa = (StegoIsa)i;
+            return 0;
+        }
+    }
+    return -1;
+}
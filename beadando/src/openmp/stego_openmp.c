@@ -1,5 +1,7 @@
+#include "common/stego_scatter.h"
 #include "common/stego_utils.h"
 #include "openmp/stego_openmp.h"
+#include "openmp/stego_kernels.h"
 
 #include <omp.h>
 #include <stdio.h>
@@ -7,74 +9,241 @@
 #include <string.h>
 #include <stdint.h>
 
-int stego_encode_omp(Image* img, const StegoMessage* msg, int num_threads)
+/*
+ * Payload bytes handed to one worker iteration.  A multiple of every k
+ * (1..4) so each block starts on a whole carrier byte.
+ */
+#define STEGO_BLOCK 192
+
+/* Team size for one call; never touches the global nthreads ICV */
+static inline int team_size(int num_threads)
+{
+    return num_threads > 0 ? num_threads : omp_get_max_threads();
+}
+
+/* Carrier byte that holds body byte `offset` (offset % bits == 0) */
+static inline size_t body_carrier(size_t offset, int bits)
+{
+    return STEGO_HEADER_CARRIER + offset * 8 / (size_t)bits;
+}
+
+/*
+ * Keyed mode: carrier slots resolved per batch.  All slots of a batch are
+ * computed and prefetched first, so the scattered read-modify-writes that
+ * follow find their lines in flight instead of missing one at a time.
+ */
+#define SCATTER_BATCH 64
+
+/* Body carriers covering payload bytes [begin, end) */
+static inline size_t body_carriers(size_t begin, size_t end, int bits)
+{
+    return ((end - begin) * 8 + (size_t)bits - 1) / (size_t)bits;
+}
+
+static void scatter_encode_block(uint8_t* pixels, const StegoScatter* sc,
+                                 const uint8_t* src, size_t n_src,
+                                 size_t first, size_t count, int bits)
 {
-    if (stego_check_capacity(img, msg) != 0)
+    uint8_t mask = (uint8_t)((1u << bits) - 1);
+    size_t  pos[SCATTER_BATCH];
+
+    for (size_t c = 0; c < count; c += SCATTER_BATCH) {
+        size_t n = count - c < SCATTER_BATCH ? count - c : SCATTER_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            pos[i] = STEGO_HEADER_CARRIER
+                   + (size_t)stego_scatter_index(sc, first + c + i);
+            STEGO_PREFETCH_W(pixels + pos[i]);
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t bit   = (c + i) * (size_t)bits;
+            size_t byte  = bit >> 3;
+            unsigned v   = src[byte];
+            if ((bit & 7) + (size_t)bits > 8 && byte + 1 < n_src)
+                v |= (unsigned)src[byte + 1] << 8;
+            v = (v >> (bit & 7)) & mask;
+            pixels[pos[i]] = (uint8_t)((pixels[pos[i]] & ~mask) | v);
+        }
+    }
+}
+
+static void scatter_decode_block(uint8_t* out, const uint8_t* pixels,
+                                 const StegoScatter* sc, size_t n_out,
+                                 size_t first, size_t count, int bits)
+{
+    uint8_t mask = (uint8_t)((1u << bits) - 1);
+    size_t  pos[SCATTER_BATCH];
+
+    memset(out, 0, n_out);
+    for (size_t c = 0; c < count; c += SCATTER_BATCH) {
+        size_t n = count - c < SCATTER_BATCH ? count - c : SCATTER_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            pos[i] = STEGO_HEADER_CARRIER
+                   + (size_t)stego_scatter_index(sc, first + c + i);
+            STEGO_PREFETCH_R(pixels + pos[i]);
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t   bit   = (c + i) * (size_t)bits;
+            size_t   byte  = bit >> 3;
+            unsigned shift = (unsigned)(bit & 7);
+            unsigned v     = (unsigned)(pixels[pos[i]] & mask) << shift;
+            out[byte] |= (uint8_t)v;
+            if (shift + (unsigned)bits > 8 && byte + 1 < n_out)
+                out[byte + 1] |= (uint8_t)(v >> 8);
+        }
+    }
+}
+
+int stego_encode_omp_keyed(Image* img, const StegoSegment* body, int n_body,
+                           int bits, const StegoKey* key, int num_threads)
+{
+    if (!key)
+        return stego_encode_omp_segments(img, body, n_body, bits, num_threads);
+
+    StegoPayload payload;
+    if (stego_payload_init(&payload, body, n_body, bits) != 0)
         return -1;
+    if (stego_check_capacity(img, payload.length, bits) != 0)
+        return -1;
+
+    stego_kernels()->encode(img->pixels, payload.header, 4);
 
-    size_t framed_len;
-    uint8_t* payload = stego_frame(msg, &framed_len);
-    if (!payload) return -1;
+    size_t total_carrier = (size_t)img->width * img->height * img->channels;
+    StegoScatter sc;
+    stego_scatter_init(&sc, key, total_carrier - STEGO_HEADER_CARRIER);
+
+    size_t length   = payload.length;
+    size_t n_blocks = (length + STEGO_BLOCK - 1) / STEGO_BLOCK;
+    int nt = team_size(num_threads);
+
+    #pragma omp parallel for schedule(static) num_threads(nt)
+    for (size_t blk = 0; blk < n_blocks; blk++) {
+        uint8_t scratch[STEGO_BLOCK];
+        size_t begin = blk * STEGO_BLOCK;
+        size_t end   = length - begin < STEGO_BLOCK
+                     ? length : begin + STEGO_BLOCK;
+        const uint8_t* src = stego_payload_view(&payload, begin, end, scratch);
+        scatter_encode_block(img->pixels, &sc, src, end - begin,
+                             body_carrier(begin, bits) - STEGO_HEADER_CARRIER,
+                             body_carriers(begin, end, bits), bits);
+    }
 
-    size_t total_bits = framed_len * 8;
+    return 0;
+}
 
-    if (num_threads > 0)
-        omp_set_num_threads(num_threads);
+int stego_encode_omp_segments(Image* img, const StegoSegment* body,
+                              int n_body, int bits, int num_threads)
+{
+    StegoPayload payload;
+    if (stego_payload_init(&payload, body, n_body, bits) != 0)
+        return -1;
+    if (stego_check_capacity(img, payload.length, bits) != 0)
+        return -1;
 
-    #pragma omp parallel for schedule(static)
-    for (size_t i = 0; i < total_bits; i++) {
-        uint8_t bit = (payload[i >> 3] >> (i & 7)) & 1;
-        img->pixels[i] = (img->pixels[i] & 0xFE) | bit;
+    stego_kernels()->encode(img->pixels, payload.header, 4);
+
+    size_t length   = payload.length;
+    size_t n_blocks = (length + STEGO_BLOCK - 1) / STEGO_BLOCK;
+    StegoEncodeFn encode = stego_encode_kernel(bits);
+    int nt = team_size(num_threads);
+
+    #pragma omp parallel for schedule(static) num_threads(nt)
+    for (size_t blk = 0; blk < n_blocks; blk++) {
+        uint8_t scratch[STEGO_BLOCK];
+        size_t begin = blk * STEGO_BLOCK;
+        size_t end   = length - begin < STEGO_BLOCK
+                     ? length : begin + STEGO_BLOCK;
+        const uint8_t* src = stego_payload_view(&payload, begin, end, scratch);
+        encode(img->pixels + body_carrier(begin, bits), src, end - begin);
     }
 
-    free(payload);
     return 0;
 }
 
-int stego_decode_omp(const Image* img, StegoMessage* msg, int num_threads)
+int stego_encode_omp(Image* img, const StegoMessage* msg, int bits,
+                     int num_threads)
+{
+    StegoSegment body = { msg->data, msg->length };
+    return stego_encode_omp_segments(img, &body, 1, bits, num_threads);
+}
+
+int stego_decode_omp_into(const Image* img, uint8_t** buf, size_t* cap,
+                          size_t* length, int num_threads)
+{
+    return stego_decode_omp_keyed_into(img, NULL, buf, cap, length,
+                                       num_threads);
+}
+
+int stego_decode_omp_keyed_into(const Image* img, const StegoKey* key,
+                                uint8_t** buf, size_t* cap, size_t* length,
+                                int num_threads)
 {
     size_t total_carrier = (size_t)img->width * img->height * img->channels;
 
-    if (total_carrier < 32) {
+    if (total_carrier < STEGO_HEADER_CARRIER) {
         fprintf(stderr, "[stego/omp] Carrier image too small to hold a header\n");
         return -1;
     }
 
-    uint8_t len_bytes[4] = {0};
-    for (int i = 0; i < 32; i++) {
-        uint8_t bit = img->pixels[i] & 1;
-        len_bytes[i >> 3] |= (bit << (i & 7));
-    }
+    uint8_t header[4];
+    size_t  len;
+    int     bits;
+    stego_kernels()->decode(header, img->pixels, 4);
 
-    uint32_t len32 =  (uint32_t)len_bytes[0]
-                   | ((uint32_t)len_bytes[1] <<  8)
-                   | ((uint32_t)len_bytes[2] << 16)
-                   | ((uint32_t)len_bytes[3] << 24);
-
-    if (len32 == 0 || (size_t)(4 + len32) * 8 > total_carrier) {
+    if (stego_header_decode(header, &len, &bits) != 0
+        || stego_carrier_bytes(len, bits) > total_carrier) {
         fprintf(stderr,
-                "[stego/omp] Invalid embedded length %u "
+                "[stego/omp] Invalid embedded length %zu at k=%d "
                 "(carrier can hold at most %zu bytes)\n",
-                len32, stego_capacity_bytes(img));
+                len, bits, stego_capacity_bytes(img, bits));
         return -1;
     }
 
-    msg->length = (size_t)len32;
-    msg->data   = (uint8_t*)malloc(len32);
-    if (!msg->data) return -1;
-
-    if (num_threads > 0)
-        omp_set_num_threads(num_threads);
-
-    #pragma omp parallel for schedule(static)
-    for (size_t byte_i = 0; byte_i < (size_t)len32; byte_i++) {
-        uint8_t val = 0;
-        size_t  base = 32 + byte_i * 8;
-        for (int b = 0; b < 8; b++) {
-            val |= (img->pixels[base + b] & 1) << b;
+    if (len > *cap) {
+        uint8_t* grown = (uint8_t*)realloc(*buf, len);
+        if (!grown) return -1;
+        *buf = grown;
+        *cap = len;
+    }
+    uint8_t* out = *buf;
+
+    size_t n_blocks = (len + STEGO_BLOCK - 1) / STEGO_BLOCK;
+    int nt = team_size(num_threads);
+
+    if (key) {
+        StegoScatter sc;
+        stego_scatter_init(&sc, key, total_carrier - STEGO_HEADER_CARRIER);
+
+        #pragma omp parallel for schedule(static) num_threads(nt)
+        for (size_t blk = 0; blk < n_blocks; blk++) {
+            size_t begin = blk * STEGO_BLOCK;
+            size_t end   = len - begin < STEGO_BLOCK ? len : begin + STEGO_BLOCK;
+            scatter_decode_block(out + begin, img->pixels, &sc, end - begin,
+                                 body_carrier(begin, bits) - STEGO_HEADER_CARRIER,
+                                 body_carriers(begin, end, bits), bits);
+        }
+    } else {
+        StegoDecodeFn decode = stego_decode_kernel(bits);
+
+        #pragma omp parallel for schedule(static) num_threads(nt)
+        for (size_t blk = 0; blk < n_blocks; blk++) {
+            size_t begin = blk * STEGO_BLOCK;
+            size_t n     = len - begin < STEGO_BLOCK ? len - begin : STEGO_BLOCK;
+            decode(out + begin, img->pixels + body_carrier(begin, bits), n);
         }
-        msg->data[byte_i] = val;
     }
 
+    *length = len;
     return 0;
-}
\ No newline at end of file
+}
+
+int stego_decode_omp(const Image* img, StegoMessage* msg, int num_threads)
+{
+    uint8_t* buf = NULL;
+    size_t   cap = 0;
+    if (stego_decode_omp_into(img, &buf, &cap, &msg->length, num_threads) != 0) {
+        free(buf);
+        return -1;
+    }
+    msg->data = buf;
+    return 0;
+}